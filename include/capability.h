@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+// --- Capability Tokens ---
+// The NM signs "<perm>:<expiry>:<user>:<file>" with SipHash-2-4 under a key
+// shared with every SS, and hands the token to the client along with the SS
+// address. The SS checks the token itself, so it never has to ask the NM.
+//   token = <sig as 16 hex digits>:<perm>:<expiry>:<user>:<file>
+
+#define CAP_KEY_ENV "LANGOS_CAP_KEY"   // Shared secret; must match on NM and all SSes
+#define CAP_DEV_KEY_ENV "LANGOS_CAP_DEV_KEY" // "1" allows the public development key instead
+#define CAP_TOKEN_TTL_SEC 30
+#define CAP_SYSTEM_USER "@system"      // Internal fetches (EXEC, replica sync)
+#define CAP_TOKEN_LEN (MAX_USERNAME_LEN + MAX_FILENAME_LEN + 48)
+
+// Loads the key from CAP_KEY_ENV. Without it the built-in development key,
+// which anyone can mint tokens with, is used only if CAP_DEV_KEY_ENV is "1".
+// Returns -1 (and logs an error) if there is no key to use.
+int cap_init_key(const char* component);
+
+// Writes a token for 'user' to use 'filename' with 'perm' ('R' or 'W').
+void cap_issue(const char* user, const char* filename, char perm, int ttl_sec, char* out, int out_size);
+
+// Checks 'token' for 'filename' and 'perm' (a 'W' token also allows 'R').
+// Returns 1 if valid, copying the holder into 'user_out' (may be NULL).
+int cap_verify(const char* token, const char* filename, char perm, char* user_out, int user_size);
@@ -1,9 +1,21 @@
 #pragma once
 #include "common.h"
+#include "capability.h"
+
+// Cached "file -> SS" answer from the NM, valid until 'expires' or a REVOKE
+typedef struct LeaseEntry {
+    char filename[MAX_FILENAME_LEN];
+    char mode;                 // 'R' or 'W' (a W lease also serves reads)
+    char ss_addr[MAX_IP_LEN + 8];
+    char token[CAP_TOKEN_LEN]; // Capability the SS checks; expires with the lease
+    time_t expires;
+    struct LeaseEntry* next;
+} LeaseEntry;
 
 typedef struct {
     char username[MAX_USERNAME_LEN];
     int nm_sock;
+    LeaseEntry* leases;
 } Client;
 
 // --- Function Prototypes ---
@@ -14,10 +26,29 @@ void client_connect_to_nm(Client* client, const char* nm_ip);
 void client_command_loop(Client* client);
 void client_parse_and_execute(Client* client, char* input);
 
-int client_connect_to_ss(const char* ip, int port);
+int client_connect_to_ss(const char* ip, int port, int quiet);
+
+// --- Location Leases (lease_cache.c) ---
+LeaseEntry* client_lease_lookup(Client* client, const char* filename, char mode);
+void client_lease_store(Client* client, const char* filename, char mode, const char* ss_addr, const char* token, int seconds);
+void client_lease_drop(Client* client, const char* filename);
+void client_lease_free_all(Client* client);
+// Applies any REVOKE the NM pushed while we were idle.
+void client_drain_revocations(Client* client);
+// recv_message() for NM replies: strips REVOKE pushes, returns the reply.
+int client_recv_nm(Client* client, char* buffer);
 
 // --- Command Handlers (Client-Side) ---
-void client_handle_read(const char* ss_addr, const char* filename);
-void client_handle_stream(const char* ss_addr, const char* filename);
-void client_handle_write(const char* ss_addr, const char* filename, int sent_num);
-void client_handle_undo(const char* ss_addr, const char* filename);
\ No newline at end of file
+// Each returns 0 when the SS handled the request, or CLIENT_SS_STALE when the
+// SS was unreachable or no longer has the file. With 'retry_allowed' the
+// stale case prints nothing, so the caller can ask the NM and try again.
+#define CLIENT_SS_STALE -1
+int client_handle_read(const char* ss_addr, const char* token, const char* filename, const char* range, int retry_allowed);
+int client_handle_stream(const char* ss_addr, const char* token, const char* filename, int wps, int retry_allowed);
+// 'durability' is NULL (the SS default) or none|async|sync.
+// 'wait_option' is "--wait=<ms>" or NULL for the SS's default lock wait.
+int client_handle_write(const char* ss_addr, const char* token, const char* filename, const char* sentences, const char* durability, const char* wait_option, int retry_allowed);
+// 'steps' <= 0 means the SS default (one commit).
+int client_handle_append(const char* ss_addr, const char* token, const char* filename, const char* text, int retry_allowed);
+int client_handle_undo(const char* ss_addr, const char* token, const char* filename, int steps, int retry_allowed);
+int client_handle_history(const char* ss_addr, const char* token, const char* filename, int retry_allowed);
\ No newline at end of file
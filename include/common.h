@@ -24,6 +24,9 @@
 #define MAX_USERNAME_LEN 256
 #define MAX_IP_LEN 16 // INET_ADDRSTRLEN
 #define MAX_PATH_LEN 1024
+#define MANIFEST_CHUNK_BYTES (BUFFER_SIZE - 512) // Max MANIFEST line during SS registration
+#define LEASE_REVOKE_MARKER '\x1e' // Starts an NM->client "REVOKE <file>" push
+#define STREAM_DEFAULT_WPS 5 // STREAM pacing (words/sec) when the client gives none
 
 // --- Error Codes ---
 typedef enum {
@@ -53,13 +56,34 @@ int send_message(int sock, const char* message);
 int recv_message(int sock, char* buffer);
 int create_listener_socket(int port);
 
+// --- Line-Framed Control Channel ---
+// NM<->SS control messages are newline-terminated so that several
+// messages arriving in one recv() are not glued together.
+typedef struct {
+    int sock;
+    char buf[BUFFER_SIZE];
+    int len;
+} LineReader;
+
+void line_reader_init(LineReader* reader, int sock);
+int recv_line(LineReader* reader, char* line, int line_size);
+int send_line(int sock, const char* message);
+
 // --- String Utilities ---
 char** split_string(const char* str, const char* delim, int* count);
 void free_split_string(char** arr, int count);
 void trim_newline(char* str);
+// The rest of 'str' after its first 'n' space-separated words and the space
+// after them, spacing untouched.
+const char* skip_words(const char* str, int n);
+// Bytes shared by a and b at the front of a[0, n) / b[0, n), and at the back
+// of the n bytes ending at a_end / b_end.
+long common_prefix(const char* a, const char* b, long n);
+long common_suffix(const char* a_end, const char* b_end, long n);
 
 // --- File Utilities ---
 long get_file_size(const char* filepath);
 int get_word_count(const char* filepath);
+int count_words(const char* content, long len);
 int get_char_count(const char* filepath);
 char* get_file_content(const char* filepath);
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+#include "storage_server.h"
+#include <stdatomic.h>
+
+// In-memory cache of whole-file contents on the SS, split into shards that
+// each own a slice of the memory budget. Entries are tagged with the file's
+// manifest version, so every commit, sync or undo invalidates them.
+// Entries double as published versions: a commit puts the new content in place
+// of the old, and readers that pinned the old one keep it until they release.
+// Admission is TinyLFU: a new file only displaces the LRU victim if it has
+// been asked for more often recently.
+
+#define CONTENT_CACHE_SHARDS 16
+#define CONTENT_CACHE_BUCKETS 64    // Hash buckets per shard
+#define CONTENT_CACHE_DEFAULT_MB 64
+// Largest file the cache holds, in MB; default a quarter of the budget. A
+// file bigger than its shard's slice of the budget may still be admitted if
+// it is requested more often than everything it displaces in that shard.
+#define CONTENT_CACHE_MAX_ENTRY_ENV "LANGOS_SS_CACHE_MAX_ENTRY_MB"
+#define CACHE_SKETCH_DEPTH 4
+#define CACHE_SKETCH_WIDTH 1024
+#define CACHE_SKETCH_RESET (CACHE_SKETCH_WIDTH * 8) // Accesses before all counters are halved
+
+// A refcounted, read-only file snapshot. Release it when done.
+typedef struct CachedContent {
+    atomic_int refs;
+    long version;   // Manifest version the bytes belong to
+    long len;
+    char data[];    // NUL-terminated
+} CachedContent;
+
+typedef struct CacheEntry {
+    char* filename;
+    unsigned long long hash;
+    CachedContent* content;
+    struct CacheEntry* next;      // Bucket chain
+    struct CacheEntry* lru_prev;  // Towards most recently used
+    struct CacheEntry* lru_next;
+} CacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry* buckets[CONTENT_CACHE_BUCKETS];
+    CacheEntry* lru_head;   // Most recently used
+    CacheEntry* lru_tail;
+    long bytes;
+    long budget;             // This shard's slice; a single larger entry may exceed it
+    atomic_long* total;      // Bytes held by all shards (ContentCache.bytes)
+    unsigned char sketch[CACHE_SKETCH_DEPTH][CACHE_SKETCH_WIDTH]; // Count-min access frequencies
+    long sketch_events;
+} CacheShard;
+
+typedef struct ContentCache {
+    CacheShard shards[CONTENT_CACHE_SHARDS];
+    atomic_long bytes;
+    long budget;
+    long max_entry;
+} ContentCache;
+
+// A budget of 0 disables caching; lookups then always read from disk.
+// 'max_entry_bytes' <= 0 picks the default (a quarter of the budget).
+ContentCache* content_cache_create(long budget_bytes, long max_entry_bytes);
+// Returns the current content of 'filename' (from RAM or disk), or NULL if
+// the file can't be read.
+CachedContent* content_cache_get(StorageServer* ss, const char* filename);
+// Offers freshly committed content at 'version' to the cache.
+void content_cache_put(StorageServer* ss, const char* filename, const char* content, long len, long version);
+void content_cache_invalidate(StorageServer* ss, const char* filename);
+void content_cache_release(CachedContent* content);
+// Reads the bytes of 'view' into a new snapshot tagged with its version (not
+// cached).
+CachedContent* content_cache_read_view(FileView* view);
@@ -35,13 +35,51 @@ char get_access(AccessNode* head, const char* username);
 void free_access_list(AccessNode* head);
 void format_access_list(AccessNode* head, char* buffer);
 
+// --- Replica Info (secondary copies of a file) ---
+#define MAX_REPLICAS 4 // Secondaries per file, on top of the primary
+typedef struct {
+    char ip[MAX_IP_LEN];
+    int client_port;
+    long synced_version; // In sync when equal to FileMetadata.version
+} ReplicaInfo;
+
+// --- Migration State (one copy of a file moving to another SS) ---
+typedef struct {
+    int active;
+    char dst_ip[MAX_IP_LEN];
+    int dst_port;
+    long synced_version;  // Version the destination has pulled so far
+    int fence;            // 0 = none, 1 = writes refused, 2 = source SS acked, -1 = FENCE failed
+} MigrationState;
+
+// --- Location Lease (a client may skip the NM for this file until it expires) ---
+typedef struct LeaseNode {
+    long session_id;      // ClientInfo.session_id of the holder
+    char ip[MAX_IP_LEN];  // SS the lease points at
+    int client_port;
+    char mode;            // 'R' or 'W'
+    time_t expires;
+    struct LeaseNode* next;
+} LeaseNode;
+
+void free_lease_list(LeaseNode* head);
+
 // --- File Metadata (The main info block) ---
 typedef struct {
     char filename[MAX_FILENAME_LEN];
     char owner[MAX_USERNAME_LEN];
     AccessNode* access_list_head;
-    char ss_ip[MAX_IP_LEN];
+    char ss_ip[MAX_IP_LEN];       // Primary SS (all writes go here)
     int ss_client_port;
+    ReplicaInfo replicas[MAX_REPLICAS];
+    int replica_count;
+    long version;                 // Bumped on every commit on the primary
+    unsigned int read_cursor;     // Round-robin over in-sync copies for READ
+    long request_count;           // Requests routed since the last rebalance pass
+    long window_requests;         // request_count as of that pass (one full window)
+    MigrationState migration;
+    int busy;                     // A CREATE or DELETE is still running; never migrated
+    LeaseNode* leases;            // Outstanding client location leases
     long size;
     int word_count;
     int char_count;
@@ -68,6 +106,10 @@ HashTable* ht_create();
 unsigned int hash_function(const char* key);
 int ht_insert(HashTable* table, FileMetadata* metadata);
 FileMetadata* ht_get(HashTable* table, const char* filename);
+// ht_get() that also takes the entry's lock before the table is released, so
+// the entry can't be deleted in between. Unlock meta->lock when done.
+FileMetadata* ht_get_locked(HashTable* table, const char* filename);
+// Waits for the entry's lock before freeing it.
 void ht_delete(HashTable* table, const char* filename);
 void ht_get_all_files(HashTable* table, char** file_list, int* count);
 void ht_free(HashTable* table);
@@ -0,0 +1,49 @@
+#pragma once
+#include "storage_server.h"
+
+// Piece-table view of a file used by WRITE commits. Every sentence is a
+// piece pointing either into the committed file buffer or into a buffer
+// produced by an edit, so applying an update only touches the pieces around
+// the target sentence; the file is serialized once at the end.
+
+typedef struct {
+    const char* text;
+    long len;
+    int words;            // As count_words() counts them
+} DocPiece;
+
+// One queued WRITE update: insert 'content' before word 'word_idx'
+typedef struct DocUpdate {
+    int sentence;         // Which of the session's sentences (see SessionSentence)
+    int word_idx;
+    char* content;
+    struct DocUpdate* next;
+} DocUpdate;
+
+typedef struct {
+    DocPiece* pieces;     // One per sentence, in order
+    int count;
+    int capacity;
+    char** owned;         // Buffers created by edits, freed with the document
+    int owned_count;
+    int owned_capacity;
+} Document;
+
+// 'base' must outlive the document; 'spans' are its sentences.
+void doc_init(Document* doc, const char* base, const SentenceSpan* spans, int count);
+// Inserts 'new_content' at word 'word_idx' of sentence 'sent_num' (which may
+// be one past the last sentence to append). Returns 0, or -1 if out of range.
+int doc_apply_update(Document* doc, int sent_num, int word_idx, const char* new_content);
+// Applies 'updates', in order, to sentence 'sent_num', up to the first update
+// for a different session sentence. Consecutive updates that can't change
+// sentence boundaries are batched on one token list of the sentence; the
+// rest go through doc_apply_update().
+int doc_apply_updates(Document* doc, int sent_num, const DocUpdate* updates);
+// Saves the sentence list into *saved (reallocated) so that doc_restore() can
+// drop edits made after it. Buffers created by those edits stay owned.
+void doc_checkpoint(const Document* doc, DocPiece** saved, int* count);
+void doc_restore(Document* doc, const DocPiece* saved, int count);
+// Joins the sentences into a new NUL-terminated buffer; 'len' and 'words'
+// (both optional) get its size and word count.
+char* doc_serialize(const Document* doc, long* len, int* words);
+void doc_free(Document* doc);
@@ -0,0 +1,38 @@
+#pragma once
+#include "storage_server.h"
+
+// Committed files are written to a temp file and renamed into place, so a
+// crashed process never leaves a torn file. Only sync fsyncs the temp file
+// before the rename; with none or async a power failure before the flusher
+// runs can leave the new name with some of its data missing. What happens
+// before the client is answered is chosen per write:
+//   none  - no fsync; the rename may be lost on power failure
+//   async - answered at once; the flusher thread fsyncs the file and the
+//           directory within SS_FLUSH_INTERVAL_MS, one directory fsync per batch
+//   sync  - the temp file is fsynced, renamed, and the directory fsynced first
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_ASYNC,
+    DURABILITY_SYNC
+} Durability;
+
+#define SS_DEFAULT_DURABILITY DURABILITY_ASYNC
+#define SS_FLUSH_INTERVAL_MS 50 // How long the flusher lets a batch gather
+
+// Parses "none", "async" or "sync"; returns -1 for anything else.
+int ss_parse_durability(const char* name);
+const char* ss_durability_name(Durability d);
+
+int ss_flusher_start(StorageServer* ss);
+
+// Atomically replaces 'filename' with data[0, len). Segmented files (and every
+// file in segmented mode, see segment_store.h) get new segments and a new
+// index instead. Returns 0 on success.
+int ss_write_file_atomic(StorageServer* ss, const char* filename, const char* data, long len, Durability d);
+// Moves an already written 'tmp_path' over 'filename' with the same guarantees.
+int ss_install_file(StorageServer* ss, const char* tmp_path, const char* filename, Durability d);
+// Appends data[0, len) to 'filename' in place (O_APPEND), or as a new last
+// segment of a segmented file. Bytes already in the file are never touched,
+// so readers of earlier versions that stop at their size are unaffected. A
+// failed append is cut off again. Returns 0 on success.
+int ss_append_file(StorageServer* ss, const char* filename, const char* data, long len, Durability d);
@@ -1,19 +1,41 @@
 #pragma once
 #include "common.h"
 #include "data_structures.h"
+#include "capability.h"
+
+#define DEFAULT_REPLICATION_FACTOR 2 // Primary + 1 replica
+
+// --- Rebalancer ---
+#define REBALANCE_INTERVAL_SEC 30
+#define REBALANCE_IMBALANCE_RATIO 1.5     // heaviest/lightest load that triggers a move
+#define REBALANCE_MIN_BYTES (64 * 1024)   // ignore byte skew smaller than this
+#define REBALANCE_MIN_REQUESTS 20         // ignore request skew smaller than this
+#define MIGRATE_BANDWIDTH_BPS (1024 * 1024) // copy-phase throttle (bytes/sec)
+#define MIGRATE_CATCHUP_ROUNDS 3
+#define MIGRATE_ACK_TIMEOUT_SEC 60
+
+// --- Client location leases ---
+#define LEASE_DURATION_SEC 30
+
+// --- NM->SS control requests ---
+#define PENDING_BUCKETS 64
+#define SS_ACK_TIMEOUT_SEC 10 // How long a client-facing CREATE/DELETE waits
 
 // Info about a connected Storage Server
 typedef struct StorageServerInfo {
     int socket;
     char ip[MAX_IP_LEN];
     int client_port;
+    long request_count; // Requests routed here since the last rebalance pass
     struct StorageServerInfo* next;
 } StorageServerInfo;
 
 // Info about a connected Client (ACTIVE SESSIONS)
 typedef struct ClientInfo {
     int socket;
+    long session_id; // Unique per connection; leases refer to this, not the fd
     char username[MAX_USERNAME_LEN];
+    pthread_mutex_t send_mutex; // Keeps REVOKE pushes out of the middle of a reply
     struct ClientInfo* next;
 } ClientInfo;
 
@@ -23,6 +45,8 @@ typedef struct UserNode {
     struct UserNode* next;
 } UserNode;
 
+struct PendingOp;
+
 // The main Name Server struct
 typedef struct {
     int server_sock;
@@ -40,9 +64,22 @@ typedef struct {
     pthread_mutex_t ss_list_mutex;
     pthread_mutex_t all_users_mutex;
 
+    // Signalled when a migration step (SYNC/FENCE) completes
+    pthread_cond_t migration_cond;
+
+    // In-flight NM->SS requests, keyed by request id
+    struct PendingOp* pending_buckets[PENDING_BUCKETS];
+    long next_request_id;
+    pthread_mutex_t pending_mutex;
+
+    long next_session_id; // Guarded by client_list_mutex
+
     // For round-robin SS selection
     int next_ss_index;
 
+    // Copies kept of every file (primary included)
+    int replication_factor;
+
 } NameServer;
 
 // Thread arg structs
@@ -55,10 +92,31 @@ typedef struct {
 typedef struct {
     NameServer* nm;
     int ss_sock;
+    char ss_ip[MAX_IP_LEN];
+    int ss_client_port;
+    LineReader reader; // Carries any bytes buffered during INIT_SS
 } NM_SSMsgArgs;
 
+typedef void (*PendingCallback)(NameServer* nm, struct PendingOp* op);
+
+// One tracked NM->SS request awaiting "ACK #<id> <status> [detail]"
+typedef struct PendingOp {
+    long id;
+    int ss_sock;
+    char ss_ip[MAX_IP_LEN];
+    int ss_port;                 // Client port of the target SS
+    char filename[MAX_FILENAME_LEN];
+    long version;                // SYNC: version requested
+    PendingCallback on_complete; // NULL = a thread waits in nm_wait_request
+    int done;
+    int status;
+    char detail[512];
+    pthread_cond_t cond;
+    struct PendingOp* next;
+} PendingOp;
+
 // --- Function Prototypes ---
-NameServer* nm_create();
+NameServer* nm_create(int replication_factor);
 void nm_run(NameServer* nm);
 void nm_free(NameServer* nm);
 
@@ -71,13 +129,42 @@ void* nm_handle_ss_messages(void* arg);
 // Client list management
 void add_client(NameServer* nm, int sock, const char* username);
 void remove_client(NameServer* nm, int sock);
+// Sends a reply to a connected client, serialized with REVOKE pushes to it.
+int nm_reply(NameServer* nm, int client_sock, const char* message);
 void nm_register_persistent_user(NameServer* nm, const char* username);
 void get_all_users(NameServer* nm, char* buffer);
 
 // SS list management
 void add_ss(NameServer* nm, int sock, const char* ip, int client_port);
 void remove_ss(NameServer* nm, int sock);
-StorageServerInfo* get_ss_for_new_file(NameServer* nm);
+int get_ss_for_new_file(NameServer* nm, StorageServerInfo* out, int max_count);
+int is_ss_online(NameServer* nm, const char* ip, int client_port);
+int nm_send_to_ss(NameServer* nm, const char* ip, int client_port, const char* message);
+
+// Tracked control requests
+PendingOp* nm_pending_create(const char* filename, PendingCallback on_complete);
+void nm_pending_free(PendingOp* op);
+int nm_send_tracked(NameServer* nm, const char* ip, int client_port, PendingOp* op, const char* message);
+int nm_wait_request(NameServer* nm, PendingOp* op, int timeout_sec, char* detail, int detail_size);
+void nm_complete_request(NameServer* nm, long id, int status, const char* detail);
+void nm_fail_requests_for_ss(NameServer* nm, int ss_sock);
+void nm_log_request_result(NameServer* nm, PendingOp* op);
+
+// Location leases (meta->lock held for both)
+int nm_grant_lease(NameServer* nm, FileMetadata* meta, int client_sock, const char* ip, int client_port, char mode);
+void nm_revoke_leases(NameServer* nm, FileMetadata* meta, int replicas_only);
+
+// Replication
+int nm_request_sync(NameServer* nm, const char* filename, const char* dst_ip, int dst_port,
+                    const char* src_ip, int src_port, long version, long rate_bps);
+void nm_replicate_file(NameServer* nm, FileMetadata* meta);
+int nm_pick_read_location(NameServer* nm, FileMetadata* meta, char* ip, int* client_port);
+void nm_failover_ss(NameServer* nm, const char* ip, int client_port);
+
+// Rebalancing
+void nm_note_ss_request(NameServer* nm, const char* ip, int client_port);
+void* nm_rebalancer_thread(void* arg);
+int nm_migrate_file(NameServer* nm, const char* filename, const char* src_ip, int src_port, const char* dst_ip, int dst_port);
 
 // Command Handlers
 void handle_view(NameServer* nm, int client_sock, const char* username, char** args, int arg_count);
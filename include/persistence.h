@@ -13,5 +13,40 @@ void nm_save_users(NameServer* nm);
 void nm_load_users(NameServer* nm);
 
 // --- Storage Server Persistence ---
-// Scans the SS data directory and builds a list of files it owns.
-char* ss_scan_directory(const char* path);
\ No newline at end of file
+// Per-file stats live in <storage>/.manifest; every change since the last
+// compaction is appended to <storage>/.manifest.journal.
+#define SS_MANIFEST_FILE ".manifest"
+#define SS_MANIFEST_JOURNAL ".manifest.journal"
+#define SS_MANIFEST_COMPACT_RECORDS 4096 // Journal records before the manifest is rewritten
+#define FNV1A64_INIT 14695981039346656037ULL
+
+// FNV-1a 64 of data[0, len) continued from 'hash' (FNV1A64_INIT for a fresh
+// buffer), so appended bytes can be folded into an existing checksum.
+unsigned long long fnv1a64(unsigned long long hash, const char* data, long len);
+
+// Loads the manifest, replays the journal and validates entries against
+// stat() (mtime + size). Falls back to a full directory scan if there is none.
+void ss_manifest_load(StorageServer* ss);
+// Records new content for 'filename' (bumps its version). Pass the word count
+// if the caller already has it, or -1 to count. 'out' may be NULL.
+void ss_manifest_put(StorageServer* ss, const char* filename, const char* content, long len, int words, ManifestEntry* out);
+// Records that 'added' was appended to the 'before_len' bytes of 'filename':
+// stats and checksum are extended, not recomputed (unless the entry doesn't
+// match 'before_len'). 'out' may be NULL.
+void ss_manifest_append(StorageServer* ss, const char* filename, long before_len, const char* added, long added_len,
+                        ManifestEntry* out);
+// Re-reads 'filename' from disk and records it. Returns 0 if the file is gone.
+int ss_manifest_refresh(StorageServer* ss, const char* filename, ManifestEntry* out);
+void ss_manifest_remove(StorageServer* ss, const char* filename);
+// Current local version of 'filename', or -1 if it isn't in the manifest.
+long ss_manifest_version(StorageServer* ss, const char* filename);
+// Opens the file's current content as 'view' (close it with ss_view_close()).
+// Commits install new content by rename and APPEND only adds bytes at the
+// end, so the view's first 'size' bytes keep seeing one version for as long
+// as it is open. 'version' is the manifest version of exactly those bytes, or
+// -1 if that can't be told (a commit installed the file but hasn't recorded it
+// yet on every try). Returns -1 if the file can't be opened.
+#define SS_OPEN_VERSION_TRIES 2
+int ss_open_view(StorageServer* ss, const char* filename, FileView* view);
+// Streams the manifest to the NM as MANIFEST chunks (sent after INIT_SS).
+int ss_send_manifest(StorageServer* ss, int sock);
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#include "storage_server.h"
+#include "durability.h"
+
+// Optional segmented on-disk format, chosen with LANGOS_SS_FORMAT=segmented.
+// A segmented document is <storage>/.<file>.segidx, a small header index
+// listing its segments in order, plus immutable segment files
+// <storage>/.<file>.seg.<id> of about SS_SEGMENT_TARGET bytes, each cut just
+// after a sentence delimiter. The plain text is the segments concatenated.
+// A commit writes new segments only for the bytes that changed, then installs
+// a new index by rename (the commit point), so its I/O follows the size of the
+// edit rather than of the document. The format is sticky per file: a plain
+// file is converted on its next full write in segmented mode, and a segmented
+// file stays segmented when the server runs in plain mode.
+
+#define SS_FORMAT_ENV "LANGOS_SS_FORMAT" // "plain" (default) or "segmented"
+#define SS_SEGMENT_TARGET (64 * 1024)
+#define SS_SEGIDX_MAGIC 0x58444753 // "SGDX"
+#define SS_SEGIDX_FORMAT 1
+
+// Loads every segment index, finishes conversions a crash interrupted and
+// deletes segments no index lists. Run before ss_manifest_load().
+void ss_segments_recover(StorageServer* ss);
+int ss_is_segmented(StorageServer* ss, const char* filename);
+// Replaces the content of 'filename' with data[0, len) in the segmented
+// format (converting a plain file). Segments whose bytes are unchanged are
+// kept. For DURABILITY_SYNC the new segments and the index are fsynced; the
+// caller makes the directory durable. Returns 0 on success.
+int ss_segments_write(StorageServer* ss, const char* filename, const char* data, long len, Durability d);
+// Adds data[0, len) at the end of a segmented file: merged into a small last
+// segment, otherwise written as a new one. Returns 0 on success.
+int ss_segments_append(StorageServer* ss, const char* filename, const char* data, long len, Durability d);
+// Fsyncs the segments written since the last call and the index. Returns 1
+// if 'filename' isn't segmented, -1 on error.
+int ss_segments_fsync(StorageServer* ss, const char* filename);
+// Deletes the file's index; its segments go once no reader needs them.
+// Returns 0 if the file wasn't segmented.
+int ss_segments_remove(StorageServer* ss, const char* filename);
+
+// --- Access to either format ---
+// stat() of the file. For a segmented file st_size is the document size and
+// the rest describes its index (a new inode for every commit).
+int ss_file_stat(StorageServer* ss, const char* filename, struct stat* st);
+// Whole current content, NUL-terminated; free() it. NULL if unreadable.
+char* ss_file_load(StorageServer* ss, const char* filename, long* len);
+// Reads up to 'len' bytes at 'off' of the current content. Returns the count.
+long ss_file_read_at(StorageServer* ss, const char* filename, char* buf, long len, long off);
+
+// Opens the current content without telling its version; '*ino' identifies
+// the install (see ss_open_view()). Returns -1 if the file can't be opened.
+int ss_view_open_current(StorageServer* ss, const char* filename, FileView* view, ino_t* ino);
+// Reads up to 'len' bytes at 'off', never past view->size. Returns the count.
+long ss_view_read(FileView* view, char* buf, long len, long off);
+// Sends bytes [off, off + len) to 'sock' with sendfile(2), straight from the
+// plain file or the segment files. Returns the bytes sent.
+long ss_view_send(FileView* view, int sock, long off, long len);
+void ss_view_close(FileView* view);
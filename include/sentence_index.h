@@ -0,0 +1,38 @@
+#pragma once
+#include "storage_server.h"
+
+// Per-file table of sentence spans (offset, length, word count), so WRITE
+// validation and sentence-range reads can find sentence N without parsing
+// the file. Sentences follow split_into_sentences(): each ends at a delimiter
+// (inclusive), and whitespace after a delimiter belongs to no sentence.
+// The index is kept in <storage>/.<file>.sidx and patched on every commit.
+
+#define SS_SIDX_MAGIC 0x58444953 // "SIDX"
+#define SS_SIDX_FORMAT 1
+
+// Finds the byte span of sentences [first, last] (0-based, inclusive) in the
+// version of the file open as 'view' (see ss_open_view()). If a commit has
+// moved the index past it, the pinned bytes are indexed instead.
+// Returns 0 on success, ERROR_FILE_NOT_FOUND, or ERROR_INVALID_COMMAND when
+// the range is outside the file.
+int ss_sentence_range(StorageServer* ss, const char* filename, FileView* view,
+                      int first, int last, long* offset, long* length);
+// Number of sentences in 'filename' (-1 if it can't be read). 'complete' is
+// set when the last one ends in a delimiter.
+int ss_sentence_count(StorageServer* ss, const char* filename, int* complete);
+// Copies the spans of 'content' (matching its exact version) into a new
+// array in '*spans'. Returns the sentence count.
+int ss_sentence_spans(StorageServer* ss, const char* filename, const struct CachedContent* content, SentenceSpan** spans);
+// After a commit turned 'before' into 'after' (now at 'version'): re-indexes
+// only the region that changed, shifts the rest, and rewrites the sidecar.
+// Returns the new sentence count.
+int ss_sentence_index_commit(StorageServer* ss, const char* filename, const struct CachedContent* before,
+                             const char* after, long after_len, long version);
+// After an APPEND of 'added' to the 'before_len' bytes of the file at
+// 'before_version' (now at 'version'): scans only an unfinished last sentence
+// and the new bytes. Returns the new sentence count, or -1 if there was no
+// index for 'before_version' to extend (it is then rebuilt when next used).
+int ss_sentence_index_append(StorageServer* ss, const char* filename, long before_version, long before_len,
+                             const char* added, long added_len, long version);
+// Drops the index and its sidecar (file deleted).
+void ss_sentence_index_remove(StorageServer* ss, const char* filename);
@@ -1,43 +1,219 @@
 #pragma once
 #include "common.h"
 #include "data_structures.h"
+#include "capability.h"
 
-// Track file locks for the COMMIT phase (ETIRW)
-typedef struct FileLockNode {
-    char filename[MAX_FILENAME_LEN];
-    pthread_mutex_t lock;
-    struct FileLockNode* next;
-} FileLockNode;
+// --- PER-FILE LOCKS (see lock_table.c) ---
+#define SS_LOCK_SHARDS 16
+#define SS_LOCK_BUCKETS 64 // Hash buckets per shard
+#define SS_WRITE_MAX_SENTENCES 64 // Sentences one WRITE session may lock
+#define SS_LOCK_WAIT_DEFAULT_MS 10000 // How long WRITE waits for busy sentences unless told
+#define SS_LOCK_WAIT_MAX_MS 60000
+#define SS_WRITE_LEASE_SEC 120 // A session loses its locks this long after they are granted
+#define SS_APPEND_TRIES 3 // Times APPEND re-locks when a commit moves the tail under it
+
+// A WRITE session blocked in lock_sentences(), queued on the file.
+typedef struct LockWaiter {
+    const int* sents;
+    int count;
+    int granted;             // Set, under the shard mutex, when its locks are handed over
+    pthread_cond_t ready;
+    struct LockWaiter* next;
+} LockWaiter;
+
+// One sentence locked by a WRITE session, numbered as when the session started.
+typedef struct {
+    int sent_num;
+    int shift_mark;          // See get_shift_mark()
+    int position;            // Index in the document the session is applied to
+    int delta;               // Change in sentence count from the session's updates to it
+} SessionSentence;
+
+// A WRITE session's commit, queued on the file until the next holder of the
+// commit lock applies it together with every other queued commit.
+typedef struct CommitRequest {
+    SessionSentence* sentences; // Ascending by sent_num
+    int sentence_count;
+    const struct DocUpdate* updates; // Each names its sentence by index into 'sentences'
+    const char* user;
+    int durability;
+    // Set by whoever applied it
+    int done;
+    const char* reply;
+    struct CommitRequest* next;
+} CommitRequest;
+
+// Lock state of one file. Exists only while someone uses it: it is freed
+// once it has no references, no sentence locks and no fence.
+// Everything but 'commit' is guarded by the shard mutex.
+typedef struct FileLock {
+    char* filename;
+    unsigned long long hash;
+    int refs;
+    pthread_mutex_t commit;  // Held across a commit, undo or sync install (ETIRW)
+    int fenced;              // Set by the NM while the file migrates away; commits refused
+    int* sentences;          // Sentences locked by open WRITE sessions
+    int sentence_count;
+    int sentence_capacity;
+    // Sentence-count changes committed while sessions are open, as a Fenwick
+    // tree over sentence indices (1-based, shift_size a power of two).
+    // Dropped when the last session on the file ends.
+    int* shift_tree;
+    int shift_size;
+    CommitRequest* pending;  // Commits waiting for the commit lock, oldest first
+    CommitRequest* pending_tail;
+    struct LockWaiter* waiters; // Sessions waiting for sentence locks, oldest first
+    struct LockWaiter* waiters_tail;
+    struct FileLock* next;
+} FileLock;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    FileLock* buckets[SS_LOCK_BUCKETS];
+} LockShard;
+
+// --- FILE MANIFEST (persisted per-file stats, see persistence.c) ---
+typedef struct ManifestEntry {
+    char* filename;
+    long size;
+    int words;
+    int chars;
+    time_t mtime;
+    long version;                 // Local commit counter
+    unsigned long long checksum;  // FNV-1a 64 of the content
+    ino_t ino;                    // Inode holding this version (0 if unknown); not persisted
+    struct ManifestEntry* next;
+} ManifestEntry;
+
+// --- SENTENCE INDEX (see sentence_index.c) ---
+#define SS_SENTENCE_INDEX_BUCKETS 256
+
+// One sentence; also the on-disk record of the .sidx sidecar
+typedef struct {
+    long start;    // Byte offset of its first character
+    int length;    // Up to and including its delimiter
+    int words;     // Words as split_into_words() counts them (delimiters included)
+} SentenceSpan;
+
+typedef struct SentenceIndex {
+    char* filename;
+    long version;         // Manifest version the spans describe
+    int count;
+    int capacity;
+    int complete;         // Last sentence ends in a delimiter
+    SentenceSpan* spans;
+    struct SentenceIndex* next;
+} SentenceIndex;
+
+// --- SEGMENTED FILES (optional on-disk format, see segment_store.c) ---
+#define SS_SEGMENT_BUCKETS 64
+
+// One segment of a segmented file; also the on-disk record of its .segidx
+typedef struct {
+    long id;                      // Stored as .<file>.seg.<id>
+    long start;                   // Offset of its first byte in the document
+    long len;
+    unsigned long long checksum;  // FNV-1a 64 of its bytes
+} SegmentEntry;
+
+// One version of a segmented file's index. Segments are never modified, only
+// dropped from a newer index; they are unlinked once no reader holds a
+// version that still lists them.
+typedef struct SegmentIndex {
+    int refs;                     // Readers holding it (see FileView)
+    ino_t ino;                    // Inode of the .segidx it was installed as
+    long size;
+    long next_id;
+    int count;
+    SegmentEntry* segs;
+    struct SegmentIndex* newer;
+} SegmentIndex;
 
-// Track Sentence Locks
-typedef struct SentenceLockNode {
+typedef struct SegmentFile {
+    char* filename;
+    SegmentIndex* oldest;         // Versions still pinned by readers, then 'current'
+    SegmentIndex* current;        // NULL once the file is deleted
+    long* dirty;                  // Segments written since the flusher last ran
+    int dirty_count;
+    int dirty_capacity;
+    struct SegmentFile* next;
+} SegmentFile;
+
+// One version of a file (plain or segmented) open for reading; see ss_open_view().
+typedef struct {
+    struct StorageServer* ss;
     char filename[MAX_FILENAME_LEN];
-    int sentence_num;
-    struct SentenceLockNode* next;
-} SentenceLockNode;
+    long version;                 // Manifest version of the bytes, -1 if it can't be told
+    long size;                    // Bytes in that version; read no further
+    int fd;                       // The plain file, or the segment last read
+    SegmentIndex* index;          // NULL for a plain file
+    int seg;                      // Segment 'fd' belongs to, -1 if none is open
+} FileView;
+
+struct CachedContent;  // content_cache.h
+struct ContentCache;
+
+// --- STREAM job (see streamer.c) ---
+typedef struct StreamJob {
+    int sock;
+    struct CachedContent* content; // File snapshot; the job holds a reference
+    long len;
+    long pos;             // Next byte not yet framed
+    int wps;              // Words per second, 0 = unthrottled
+    long long start_ms;
+    long words_sent;
+    char frame[BUFFER_SIZE];
+    int frame_len;
+    int frame_off;        // Bytes of 'frame' already on the wire
+    struct StreamJob* next;
+} StreamJob;
 
-// --- MODIFICATION LOG ---
-typedef struct ModificationLogNode {
-    int id; // Unique, increasing ID
+// --- Async durability: a committed file still waiting for fsync (see durability.c) ---
+typedef struct FlushRequest {
     char filename[MAX_FILENAME_LEN];
-    int original_sentence_index;
-    int sentence_delta;
-    struct ModificationLogNode* next;
-} ModificationLogNode;
+    struct FlushRequest* next;
+} FlushRequest;
 
-typedef struct {
+typedef struct StorageServer {
     char storage_path[MAX_PATH_LEN];
     int nm_sock;
     int client_listen_sock;
     int client_port;
     
-    FileLockNode* file_locks_head;
-    SentenceLockNode* sentence_locks_head;
-    
-    ModificationLogNode* mod_log_head; 
-    int next_log_id; // Auto-incrementing ID
+    // Per-file commit locks, fences and sentence locks, sharded by filename hash
+    LockShard lock_shards[SS_LOCK_SHARDS];
     
-    pthread_mutex_t internal_locks_mutex;
+    pthread_mutex_t nm_send_mutex; // Serializes writers on nm_sock
+
+    // File manifest: hash table of ManifestEntry plus its append-only journal
+    ManifestEntry** manifest_buckets;
+    int manifest_capacity;
+    int manifest_count;
+    FILE* manifest_journal;
+    int journal_records;           // Records since the last compaction
+    pthread_mutex_t manifest_mutex;
+
+    // Sentence indexes loaded from .sidx sidecars or built on demand
+    SentenceIndex* sentence_index[SS_SENTENCE_INDEX_BUCKETS];
+    pthread_mutex_t sentence_index_mutex;
+
+    // Hot file contents (NULL when the cache is disabled)
+    struct ContentCache* content_cache;
+
+    // STREAM jobs handed to the streamer thread, which is woken via the pipe
+    StreamJob* stream_incoming;
+    pthread_mutex_t stream_mutex;
+    int stream_wake[2];
+
+    // Files committed with async durability, fsynced in batches by the flusher
+    FlushRequest* flush_pending;
+    pthread_mutex_t flush_mutex;
+    pthread_cond_t flush_cond;
+
+    // Segmented files, all loaded at startup (see segment_store.c)
+    int segmented;                 // New files and full rewrites use the segmented format
+    SegmentFile* segment_files[SS_SEGMENT_BUCKETS];
+    pthread_mutex_t segment_mutex;
 
 } StorageServer;
 
@@ -52,8 +228,19 @@ typedef struct {
     char client_ip[MAX_IP_LEN];
 } SS_ClientThreadArgs;
 
+// Replica catch-up job: pull 'filename' at 'version' from the primary
+typedef struct {
+    struct StorageServer* ss;
+    char filename[MAX_FILENAME_LEN];
+    char src_ip[MAX_IP_LEN];
+    int src_port;
+    long version;
+    long rate_bps; // 0 = unthrottled
+    long req_id;   // NM request id to acknowledge, -1 = none
+} SS_SyncArgs;
+
 // --- Function Prototypes ---
-StorageServer* ss_create(const char* path, int client_port);
+StorageServer* ss_create(const char* path, int client_port, long cache_bytes);
 void ss_run(StorageServer* ss, const char* nm_ip, int nm_port);
 void ss_connect_to_nm(StorageServer* ss, const char* nm_ip, int nm_port);
 void ss_free(StorageServer* ss);
@@ -61,20 +248,43 @@ void ss_free(StorageServer* ss);
 void* ss_listen_for_clients(void* arg);
 void* ss_handle_client_connection(void* arg);
 void* ss_listen_to_nm(void* arg);
+void* ss_sync_from_primary(void* arg);
+int ss_send_to_nm(StorageServer* ss, const char* message);
+
+int ss_streamer_start(StorageServer* ss);
+int ss_stream_submit(StorageServer* ss, int sock, struct CachedContent* content, int wps);
 
-pthread_mutex_t* get_file_commit_lock(StorageServer* ss, const char* filename);
-int try_lock_sentence(StorageServer* ss, const char* filename, int sent_num);
-void unlock_sentence(StorageServer* ss, const char* filename, int sent_num);
+void ss_locks_init(StorageServer* ss);
+// Takes the file's commit lock; pass the result to ss_commit_unlock().
+FileLock* ss_commit_lock(StorageServer* ss, const char* filename);
+void ss_commit_unlock(StorageServer* ss, FileLock* lock);
+// Queues 'req' on the file and takes its commit lock. If req->done is still
+// unset, the caller applies the queue returned by ss_commit_take().
+FileLock* ss_commit_join(StorageServer* ss, const char* filename, CommitRequest* req);
+CommitRequest* ss_commit_take(StorageServer* ss, FileLock* lock);
+// Locks all of 'sents' or none, waiting up to 'wait_ms' behind earlier
+// sessions that want any of them. Returns 0 if the wait ran out.
+int lock_sentences(StorageServer* ss, const char* filename, const int* sents, int count, int wait_ms);
+void unlock_sentences(StorageServer* ss, const char* filename, const int* sents, int count);
+void set_file_fenced(StorageServer* ss, const char* filename, int fenced);
+int is_file_fenced(StorageServer* ss, const char* filename);
 
-// --- UPDATED SHIFT HELPERS ---
+// --- SHIFT HELPERS (per file, kept with the file's locks) ---
+// Records that a commit at sentence 'index' changed the sentence count by 'delta'.
+// Only kept while the file has an open WRITE session.
 void log_modification(StorageServer* ss, const char* filename, int index, int delta);
-int get_current_log_id(StorageServer* ss); // Returns the current "Tip" of the log
-int get_sentence_shift(StorageServer* ss, const char* filename, int original_index, int start_log_id);
+// Taken by a session once it holds its sentence lock; pass it to get_sentence_shift().
+int get_shift_mark(StorageServer* ss, const char* filename, int original_index);
+// How far sentence 'original_index' has moved since 'mark' was taken.
+int get_sentence_shift(StorageServer* ss, const char* filename, int original_index, int mark);
 
-void handle_ss_read(StorageServer* ss, int client_sock, const char* filename);
-void handle_ss_stream(StorageServer* ss, int client_sock, const char* filename);
-void handle_ss_write(StorageServer* ss, int client_sock, const char* filename, int sent_num);
+void handle_ss_read(StorageServer* ss, int client_sock, const char* filename, const char* range);
+int handle_ss_stream(StorageServer* ss, int client_sock, const char* filename, int wps);
+// 'spec' names the sentences to lock: "3", "1,4" or "2-5"
+void handle_ss_write(StorageServer* ss, int client_sock, const char* filename, const char* spec, int durability, int wait_ms, const char* user);
 void handle_ss_create(StorageServer* ss, const char* filename);
 void handle_ss_delete(StorageServer* ss, const char* filename);
 void handle_ss_get_content(StorageServer* ss, const char* filename);
-void handle_ss_undo(StorageServer* ss, int client_sock, const char* filename);
\ No newline at end of file
+void handle_ss_undo(StorageServer* ss, int client_sock, const char* filename, int steps);
+void handle_ss_append(StorageServer* ss, int client_sock, const char* filename, const char* text, const char* user);
+void handle_ss_history(StorageServer* ss, int client_sock, const char* filename);
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+
+// Byte-class scanning over text buffers: whitespace (as isspace() in the C
+// locale) and sentence delimiters ('.', '!', '?'). Blocks of 64 bytes are
+// classified at once with AVX2 or SSE2 when the CPU has them, with a
+// byte-at-a-time fallback. Every function takes an explicit length and does
+// not stop at '\0'.
+
+// Offset of the first delimiter in data[0, len), or len if there is none.
+long text_find_delimiter(const char* data, long len);
+// Offset of the first whitespace or delimiter byte, or len.
+long text_find_separator(const char* data, long len);
+// Length of the whitespace run at the start of 'data'.
+long text_skip_space(const char* data, long len);
+// Length of the whitespace/delimiter run at the start of 'data'.
+long text_skip_separators(const char* data, long len);
+
+// Counts words (runs of bytes that are neither whitespace nor delimiters)
+// that start in data[0, len). '*in_word' says whether the byte just before
+// 'data' was inside a word and is updated for the next chunk; pass NULL for
+// a standalone buffer.
+long text_count_words(const char* data, long len, int* in_word);
+
+// Kernel in use: "avx2", "sse2" or "scalar".
+const char* text_scan_impl(void);
+// Forces a kernel by name (for benchmarks). Returns -1 if this CPU or build
+// doesn't support it.
+int text_scan_use(const char* impl);
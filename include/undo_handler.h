@@ -1,10 +1,46 @@
 #pragma once
-#include "common.h"
+#include "storage_server.h"
+#include "content_cache.h"
 
-// Creates a backup of the current file for undo purposes.
-// Returns 1 on success, 0 on failure.
-int create_undo_backup(const char* filepath, const char* undo_filepath);
+// Undo history. Every commit appends one record to <storage>/.<file>.hist
+// with the reverse delta of that commit: the offset where it changed the
+// file, how many bytes it wrote there, and the bytes they replaced. UNDO <n>
+// applies the newest n records backwards to the current content and then cuts
+// them off the log. Only the newest SS_HISTORY_DEPTH commits are kept.
 
-// Reverts the file from the undo backup.
-// Returns 1 on success, 0 on failure.
-int perform_undo(const char* filepath, const char* undo_filepath);
\ No newline at end of file
+#define SS_HISTORY_DEPTH 32
+#define SS_HIST_MAGIC 0x54534948 // "HIST"
+
+// On-disk record header; the user name and then the replaced bytes follow.
+typedef struct {
+    int magic;
+    int user_len;
+    long version;         // Manifest version the commit produced
+    long time;
+    long size_after;      // File size after the commit
+    long offset;          // Where the commit changed the file
+    long new_len;         // Bytes the commit wrote at 'offset'
+    long old_len;         // Bytes those replaced
+} HistRecord;
+
+// Appends the record for a commit from 'before' to 'after' (now at 'version').
+void ss_history_record(StorageServer* ss, const char* filename, const char* user,
+                       const char* before, long before_len, const char* after, long after_len,
+                       long version, int sync);
+
+// The same for an APPEND of 'added_len' bytes, without needing either content.
+void ss_history_record_append(StorageServer* ss, const char* filename, const char* user,
+                              long before_len, long added_len, long version, int sync);
+
+// Rebuilds the content as it was 'steps' commits before 'current'. Returns 0
+// with a malloc'd buffer in *content, ERROR_FILE_NOT_FOUND if fewer commits
+// are recorded (*available says how many), or ERROR_SYSTEM_FAILURE if the
+// log doesn't lead back from 'current'.
+int ss_history_rewind(StorageServer* ss, const char* filename, const CachedContent* current, int steps,
+                      char** content, long* len, int* available);
+// Drops the newest 'steps' records once the rewound content is installed as 'version'.
+void ss_history_pop(StorageServer* ss, const char* filename, int steps, long version);
+
+// One line per undoable commit, newest first, as a malloc'd string.
+char* ss_history_describe(StorageServer* ss, const char* filename, int* count);
+void ss_history_remove(StorageServer* ss, const char* filename);
@@ -0,0 +1,79 @@
+#include "text_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Throughput of the text scanning kernels on synthetic prose.
+// Usage: text_scan_bench [size_mb] [rounds]
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Words of 1-10 letters, mostly single spaces, a sentence end every ~12 words
+// and a newline every ~80.
+static char* make_text(long len) {
+    char* text = (char*)malloc(len);
+    unsigned int seed = 42;
+    long i = 0;
+    while (i < len) {
+        int word = 1 + rand_r(&seed) % 10;
+        for (int k = 0; k < word && i < len; k++) text[i++] = 'a' + rand_r(&seed) % 26;
+        int roll = rand_r(&seed) % 80;
+        if (i < len && roll < 7) text[i++] = ".!?"[roll % 3];
+        if (i < len) text[i++] = roll == 79 ? '\n' : ' ';
+    }
+    return text;
+}
+
+// Walks sentences the way the sentence index builder does.
+static long walk_sentences(const char* text, long len) {
+    long pos = 0, count = 0;
+    while (pos < len) {
+        long end = pos + text_find_delimiter(text + pos, len - pos);
+        count++;
+        if (end == len) break;
+        pos = end + 1;
+        pos += text_skip_space(text + pos, len - pos);
+    }
+    return count;
+}
+
+static void run(const char* impl, const char* text, long len, int rounds) {
+    if (text_scan_use(impl) < 0) {
+        printf("%-7s  not supported on this CPU\n", impl);
+        return;
+    }
+    long words = 0, sentences = 0;
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++) words = text_count_words(text, len, NULL);
+    double words_sec = now_sec() - start;
+
+    start = now_sec();
+    for (int r = 0; r < rounds; r++) sentences = walk_sentences(text, len);
+    double sentences_sec = now_sec() - start;
+
+    double gb = (double)len * rounds / 1e9;
+    printf("%-7s  words %8.2f GB/s (%ld)   sentences %8.2f GB/s (%ld)\n",
+           impl, gb / words_sec, words, gb / sentences_sec, sentences);
+}
+
+int main(int argc, char* argv[]) {
+    long size_mb = argc > 1 ? atol(argv[1]) : 64;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (size_mb <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s [size_mb] [rounds]\n", argv[0]);
+        return 1;
+    }
+    long len = size_mb * 1024 * 1024;
+    char* text = make_text(len);
+    printf("%ld MB x %d rounds, default kernel: %s\n", size_mb, rounds, text_scan_impl());
+    run("scalar", text, len, rounds);
+    run("sse2", text, len, rounds);
+    run("avx2", text, len, rounds);
+    free(text);
+    return 0;
+}
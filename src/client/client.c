@@ -5,6 +5,7 @@ Client* client_create(const char* user) {
     if (!client) return NULL;
     strncpy(client->username, user, MAX_USERNAME_LEN - 1);
     client->nm_sock = -1;
+    client->leases = NULL;
     return client;
 }
 
@@ -71,7 +72,31 @@ void client_command_loop(Client* client) {
     }
 }
 
-// In src/client/client.c
+// Runs READ/STREAM/WRITE/APPEND/UNDO/HISTORY against the SS at 'ss_addr'.
+// 'input' is the whole command line; APPEND sends its text as typed.
+static int client_dispatch_to_ss(const char* cmd, const char* ss_addr, const char* token, const char* input,
+                                 char** args, int arg_count, int retry_allowed) {
+    const char* filename = args[1];
+    if (strcmp(cmd, "READ") == 0) {
+        return client_handle_read(ss_addr, token, filename, (arg_count >= 3) ? args[2] : NULL, retry_allowed);
+    } else if (strcmp(cmd, "STREAM") == 0) {
+        int wps = (arg_count >= 3) ? atoi(args[2]) : STREAM_DEFAULT_WPS;
+        return client_handle_stream(ss_addr, token, filename, wps, retry_allowed);
+    } else if (strcmp(cmd, "WRITE") == 0) {
+        const char* durability = NULL;
+        const char* wait_option = NULL;
+        for (int i = 3; i < arg_count; i++) {
+            if (strncmp(args[i], "--wait=", 7) == 0) wait_option = args[i];
+            else durability = args[i];
+        }
+        return client_handle_write(ss_addr, token, filename, args[2], durability, wait_option, retry_allowed);
+    } else if (strcmp(cmd, "APPEND") == 0) {
+        return client_handle_append(ss_addr, token, filename, skip_words(input, 2), retry_allowed);
+    } else if (strcmp(cmd, "HISTORY") == 0) {
+        return client_handle_history(ss_addr, token, filename, retry_allowed);
+    }
+    return client_handle_undo(ss_addr, token, filename, (arg_count >= 3) ? atoi(args[2]) : 0, retry_allowed);
+}
 
 void client_parse_and_execute(Client* client, char* input) {
     int arg_count = 0;
@@ -83,44 +108,71 @@ void client_parse_and_execute(Client* client, char* input) {
     
     const char* cmd = args[0];
     
-    // Check for R/W/STREAM/UNDO commands
-    if (strcmp(cmd, "READ") == 0 || strcmp(cmd, "STREAM") == 0 || 
-        strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "UNDO") == 0) 
+    // Check for R/W/STREAM/APPEND/UNDO/HISTORY commands
+    if (strcmp(cmd, "READ") == 0 || strcmp(cmd, "STREAM") == 0 || strcmp(cmd, "WRITE") == 0 ||
+        strcmp(cmd, "APPEND") == 0 || strcmp(cmd, "UNDO") == 0 || strcmp(cmd, "HISTORY") == 0) 
     {
         if (arg_count < 2) {
             printf("Usage: %s <filename> [args...]\n", cmd);
             free_split_string(args, arg_count);
             return;
         }
+        if (strcmp(cmd, "WRITE") == 0 && arg_count < 3) {
+            printf("Usage: WRITE <filename> <sentence_number>[,<n>|-<n>...] [none|async|sync] [--wait=<ms>]\n");
+            free_split_string(args, arg_count);
+            return;
+        }
+        if (strcmp(cmd, "APPEND") == 0 && arg_count < 3) {
+            printf("Usage: APPEND <filename> <text>\n");
+            free_split_string(args, arg_count);
+            return;
+        }
+        const char* filename = args[1];
+        char mode = (strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "APPEND") == 0 || strcmp(cmd, "UNDO") == 0) ? 'W' : 'R';
         
-        // 1. Send request to NM
+        // 1. A live lease lets us skip the NM entirely. Not for HISTORY: only
+        //    the primary has it, and a read lease may point at a replica.
+        client_drain_revocations(client);
+        LeaseEntry* cached = strcmp(cmd, "HISTORY") == 0 ? NULL : client_lease_lookup(client, filename, mode);
+        if (cached) {
+            char ss_addr[MAX_IP_LEN + 8];
+            char token[CAP_TOKEN_LEN];
+            strncpy(ss_addr, cached->ss_addr, sizeof(ss_addr));
+            strncpy(token, cached->token, sizeof(token));
+            if (client_dispatch_to_ss(cmd, ss_addr, token, input, args, arg_count, 1) == 0) {
+                free_split_string(args, arg_count);
+                return;
+            }
+            client_lease_drop(client, filename); // Stale; ask the NM below
+        }
+        
+        // 2. Send request to NM
         send_message(client->nm_sock, input);
         
-        // 2. Get response (e.g., "202 OK <ip>:<port>" or "404 ERROR...")
+        // 3. Get response (e.g., "202 OK <ip>:<port> LEASE <sec> TOKEN <cap>" or "404 ERROR...")
         char nm_response[BUFFER_SIZE];
-        if (recv_message(client->nm_sock, nm_response) <= 0) {
+        if (client_recv_nm(client, nm_response) <= 0) {
             fprintf(stderr, "Name Server disconnected.\n");
             exit(1); // Exit client
         }
         
-        // 3. Check response
+        // 4. Check response
         if (strncmp(nm_response, "202 OK", 6) == 0) {
             char* ss_addr = nm_response + 7; // Skip "202 OK "
-            const char* filename = args[1];
+            char* token = strstr(ss_addr, " TOKEN ");
+            char* lease = strstr(ss_addr, " LEASE ");
+            if (token) {
+                *token = '\0';
+                token += 7;
+            }
+            if (lease) {
+                *lease = '\0';
+                client_lease_store(client, filename, mode, ss_addr, token ? token : "", atoi(lease + 7));
+            }
             
-            // 4. Call the specific handler to connect to SS
-            if (strcmp(cmd, "READ") == 0) {
-                client_handle_read(ss_addr, filename);
-            } else if (strcmp(cmd, "STREAM") == 0) {
-                client_handle_stream(ss_addr, filename);
-            } else if (strcmp(cmd, "WRITE") == 0) {
-                if (arg_count < 3) {
-                    printf("Usage: WRITE <filename> <sentence_number>\n");
-                } else {
-                    client_handle_write(ss_addr, filename, atoi(args[2]));
-                }
-            } else if (strcmp(cmd, "UNDO") == 0) {
-                client_handle_undo(ss_addr, filename);
+            // 5. Call the specific handler to connect to SS
+            if (client_dispatch_to_ss(cmd, ss_addr, token ? token : "-", input, args, arg_count, 0) != 0) {
+                client_lease_drop(client, filename);
             }
         } else {
             // Error from NM (401, 404, 503, etc.)
@@ -135,7 +187,7 @@ void client_parse_and_execute(Client* client, char* input) {
         
         // 2. Loop to read *all* lines of output
         char nm_response[BUFFER_SIZE];
-        while (recv_message(client->nm_sock, nm_response) > 0) {
+        while (client_recv_nm(client, nm_response) > 0) {
             // Check if this is the final "OK" message
             if (strncmp(nm_response, "201 OK: Execution finished.", 27) == 0) {
                 break; // Stop reading
@@ -158,7 +210,7 @@ void client_parse_and_execute(Client* client, char* input) {
         send_message(client->nm_sock, input);
         
         char nm_response[BUFFER_SIZE * 10]; // Larger buffer for VIEW -l
-        if (recv_message(client->nm_sock, nm_response) <= 0) {
+        if (client_recv_nm(client, nm_response) <= 0) {
             fprintf(stderr, "Name Server disconnected.\n");
             exit(1); // Exit client
         }
@@ -197,6 +249,7 @@ int main(int argc, char* argv[]) {
     
     client_run(client, nm_ip);
     
+    client_lease_free_all(client);
     free(client);
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,17 @@
 #include "client.h"
+#include <poll.h>
 
-int client_connect_to_ss(const char* ip, int port) {
+// The first reply from an SS that no longer serves a file: it dropped the
+// connection, says the file isn't there, has fenced it for migration, or no
+// longer accepts our capability token.
+static int is_stale_reply(const char* buffer, int bytes_read) {
+    return bytes_read <= 0 ||
+           strncmp(buffer, "404 ERROR: File not found on SS.", 32) == 0 ||
+           strncmp(buffer, "401 ERROR: Missing or invalid capability", 40) == 0 ||
+           strncmp(buffer, "423 ERROR: File is being migrated", 33) == 0;
+}
+
+int client_connect_to_ss(const char* ip, int port, int quiet) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         perror("socket ss");
@@ -17,170 +28,310 @@ int client_connect_to_ss(const char* ip, int port) {
     }
 
     if (connect(sock, (struct sockaddr*)&ss_addr, sizeof(ss_addr)) < 0) {
-        perror("connect ss");
+        if (!quiet) perror("connect ss");
         close(sock);
         return -1;
     }
     return sock;
 }
 
-void client_handle_read(const char* ss_addr, const char* filename) {
+// 'range' is an optional --bytes=off:len or --sentences=a:b, passed through.
+int client_handle_read(const char* ss_addr, const char* token, const char* filename, const char* range, int retry_allowed) {
     int count = 0;
     char** parts = split_string(ss_addr, ":", &count);
     if (count != 2) {
         fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
-    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]));
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
     if (ss_sock < 0) {
-        fprintf(stderr, "Failed to connect to Storage Server.\n");
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
     char req[BUFFER_SIZE];
-    snprintf(req, sizeof(req), "READ %s", filename);
+    if (range) {
+        snprintf(req, sizeof(req), "READ %s %s %s", filename, range, token);
+    } else {
+        snprintf(req, sizeof(req), "READ %s %s", filename, token);
+    }
     send_message(ss_sock, req);
     
     char buffer[BUFFER_SIZE];
-    int bytes_read;
-    while ((bytes_read = recv_message(ss_sock, buffer)) > 0) {
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (retry_allowed && is_stale_reply(buffer, bytes_read)) {
+        close(ss_sock);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    while (bytes_read > 0) {
         printf("%s", buffer); // Print content as it arrives
+        bytes_read = recv_message(ss_sock, buffer);
     }
     printf("\n"); // Add a final newline
     
     close(ss_sock);
     free_split_string(parts, count);
+    return 0;
 }
 
-void client_handle_stream(const char* ss_addr, const char* filename) {
+int client_handle_history(const char* ss_addr, const char* token, const char* filename, int retry_allowed) {
     int count = 0;
     char** parts = split_string(ss_addr, ":", &count);
     if (count != 2) {
         fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
-    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]));
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
     if (ss_sock < 0) {
-        fprintf(stderr, "Failed to connect to Storage Server.\n");
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
     char req[BUFFER_SIZE];
-    snprintf(req, sizeof(req), "STREAM %s", filename);
+    snprintf(req, sizeof(req), "HISTORY %s %s", filename, token);
     send_message(ss_sock, req);
     
+    // A status line, then one line per commit until the SS closes
     char buffer[BUFFER_SIZE];
-    int bytes_read;
-    while ((bytes_read = recv_message(ss_sock, buffer)) > 0) {
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (retry_allowed && is_stale_reply(buffer, bytes_read)) {
+        close(ss_sock);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    while (bytes_read > 0) {
         printf("%s", buffer);
-        fflush(stdout); // Ensure it prints immediately
+        bytes_read = recv_message(ss_sock, buffer);
     }
-    printf("\n");
     
     close(ss_sock);
     free_split_string(parts, count);
+    return 0;
 }
 
-void client_handle_write(const char* ss_addr, const char* filename, int sent_num) {
+int client_handle_stream(const char* ss_addr, const char* token, const char* filename, int wps, int retry_allowed) {
     int count = 0;
     char** parts = split_string(ss_addr, ":", &count);
     if (count != 2) {
         fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
-    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]));
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
     if (ss_sock < 0) {
-        fprintf(stderr, "Failed to connect to Storage Server.\n");
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
     char req[BUFFER_SIZE];
-    snprintf(req, sizeof(req), "WRITE %s %d", filename, sent_num);
+    snprintf(req, sizeof(req), "STREAM %s %d %s", filename, wps, token);
     send_message(ss_sock, req);
     
-    // Wait for ACK
     char buffer[BUFFER_SIZE];
-    if (recv_message(ss_sock, buffer) <= 0) {
-        fprintf(stderr, "SS disconnected or failed to send ACK.\n");
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (retry_allowed && is_stale_reply(buffer, bytes_read)) {
         close(ss_sock);
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
+    }
+    while (bytes_read > 0) {
+        printf("%s", buffer);
+        fflush(stdout); // Ensure it prints immediately
+        bytes_read = recv_message(ss_sock, buffer);
     }
+    printf("\n");
     
-    if (strncmp(buffer, "202 ACK_WRITE", 13) != 0) {
-        // Error from SS (e.g., locked)
-        printf("%s\n", buffer);
+    close(ss_sock);
+    free_split_string(parts, count);
+    return 0;
+}
+
+// Handles the SS's replies to numbered WRITE updates: "ACK <seq>" is silent,
+// "ERR <seq> <code> <reason>" is printed. Without 'until_result' only lines
+// that have already arrived are read; with it, reading goes on until the
+// commit result, which is printed. Returns -1 if the SS went away.
+static int write_session_replies(LineReader* reader, int until_result) {
+    char line[BUFFER_SIZE];
+    while (1) {
+        if (!until_result && !memchr(reader->buf, '\n', reader->len)) {
+            struct pollfd pfd = { reader->sock, POLLIN, 0 };
+            if (poll(&pfd, 1, 0) <= 0) return 0;
+        }
+        if (recv_line(reader, line, sizeof(line)) <= 0) return -1;
+        int seq, offset = 0;
+        if (sscanf(line, "ERR %d %n", &seq, &offset) == 1) {
+            printf("Update %d rejected: %s\n", seq, line + offset);
+        } else if (strncmp(line, "ACK ", 4) != 0) {
+            printf("%s\n", line);
+            return 0;
+        }
+    }
+}
+
+int client_handle_write(const char* ss_addr, const char* token, const char* filename, const char* sentences, const char* durability, const char* wait_option, int retry_allowed) {
+    int count = 0;
+    char** parts = split_string(ss_addr, ":", &count);
+    if (count != 2) {
+        fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
+    if (ss_sock < 0) {
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    
+    char req[BUFFER_SIZE];
+    snprintf(req, sizeof(req), "WRITE %s %s%s%s%s%s %s", filename, sentences, durability ? " " : "", durability ? durability : "",
+             wait_option ? " " : "", wait_option ? wait_option : "", token);
+    send_message(ss_sock, req);
+    
+    // Wait for ACK (the SS queues us while another session has the sentence)
+    char buffer[BUFFER_SIZE];
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (bytes_read <= 0 || strncmp(buffer, "202 ACK_WRITE", 13) != 0) {
+        int stale = is_stale_reply(buffer, bytes_read);
+        if (!(retry_allowed && stale)) {
+            if (bytes_read <= 0) {
+                fprintf(stderr, "SS disconnected or failed to send ACK.\n");
+            } else {
+                printf("%s\n", buffer); // Error from SS (e.g., locked)
+            }
+        }
         close(ss_sock);
         free_split_string(parts, count);
-        return;
+        return stale ? CLIENT_SS_STALE : 0;
     }
 
     // --- Start interactive session ---
-    printf("Entering WRITE mode for sentence %d. Type '<word_idx> <content>' or 'ETIRW' to finish.\n", sent_num);
+    // Updates are numbered and sent without waiting; the SS checks each one
+    // as it arrives and rejections are shown as soon as they are back.
+    if (strchr(sentences, ',') || strchr(sentences, '-')) {
+        printf("Entering WRITE mode for sentences %s. Type '<sentence>:<word_idx> <content>' or 'ETIRW' to finish.\n", sentences);
+    } else {
+        printf("Entering WRITE mode for sentence %s. Type '<word_idx> <content>' or 'ETIRW' to finish.\n", sentences);
+    }
+    const char* lease = strstr(buffer, " LEASE ");
+    if (lease) printf("The session ends %d seconds from now; type ETIRW before then.\n", atoi(lease + 7));
     
+    LineReader reader;
+    line_reader_init(&reader, ss_sock);
     char line[BUFFER_SIZE];
+    char update[BUFFER_SIZE + 16];
+    int seq = 0;
+    int finished = 0;
     while (1) {
+        if (write_session_replies(&reader, 0) < 0) break;
         printf("WRITE > ");
         if (fgets(line, sizeof(line), stdin) == NULL) {
-            break; // EOF
+            break; // EOF; the SS drops the session
         }
         trim_newline(line);
         
         if (strlen(line) == 0) continue;
         
-        send_message(ss_sock, line);
-        
         if (strcmp(line, "ETIRW") == 0) {
+            finished = send_line(ss_sock, line) == 0;
             break;
         }
-        // Note: We don't wait for an ACK per-line, only at the end
+        snprintf(update, sizeof(update), "U %d %s", ++seq, line);
+        if (send_line(ss_sock, update) < 0) break;
     }
     
     // Wait for final response
-    if (recv_message(ss_sock, buffer) > 0) {
-        printf("%s\n", buffer);
-    } else {
+    if (!finished || write_session_replies(&reader, 1) < 0) {
         fprintf(stderr, "Failed to get final response from SS.\n");
     }
     
     close(ss_sock);
     free_split_string(parts, count);
+    return 0;
 }
 
-void client_handle_undo(const char* ss_addr, const char* filename) {
+int client_handle_append(const char* ss_addr, const char* token, const char* filename, const char* text, int retry_allowed) {
     int count = 0;
     char** parts = split_string(ss_addr, ":", &count);
     if (count != 2) {
         fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
+    }
+
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
+    if (ss_sock < 0) {
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+
+    char req[BUFFER_SIZE];
+    snprintf(req, sizeof(req), "APPEND %s %s %s", filename, text, token);
+    send_message(ss_sock, req);
+
+    char buffer[BUFFER_SIZE];
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (retry_allowed && is_stale_reply(buffer, bytes_read)) {
+        close(ss_sock);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    if (bytes_read > 0) {
+        printf("%s\n", buffer);
+    }
+
+    close(ss_sock);
+    free_split_string(parts, count);
+    return 0;
+}
+
+int client_handle_undo(const char* ss_addr, const char* token, const char* filename, int steps, int retry_allowed) {
+    int count = 0;
+    char** parts = split_string(ss_addr, ":", &count);
+    if (count != 2) {
+        fprintf(stderr, "Invalid SS address from NM: %s\n", ss_addr);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
     }
     
-    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]));
+    int ss_sock = client_connect_to_ss(parts[0], atoi(parts[1]), retry_allowed);
     if (ss_sock < 0) {
-        fprintf(stderr, "Failed to connect to Storage Server.\n");
+        if (!retry_allowed) fprintf(stderr, "Failed to connect to Storage Server.\n");
         free_split_string(parts, count);
-        return;
+        return CLIENT_SS_STALE;
     }
     
     char req[BUFFER_SIZE];
-    snprintf(req, sizeof(req), "UNDO %s", filename);
+    if (steps > 0) {
+        snprintf(req, sizeof(req), "UNDO %s %d %s", filename, steps, token);
+    } else {
+        snprintf(req, sizeof(req), "UNDO %s %s", filename, token);
+    }
     send_message(ss_sock, req);
     
     char buffer[BUFFER_SIZE];
-    if (recv_message(ss_sock, buffer) > 0) {
+    int bytes_read = recv_message(ss_sock, buffer);
+    if (retry_allowed && is_stale_reply(buffer, bytes_read)) {
+        close(ss_sock);
+        free_split_string(parts, count);
+        return CLIENT_SS_STALE;
+    }
+    if (bytes_read > 0) {
         printf("%s\n", buffer);
     }
     
     close(ss_sock);
     free_split_string(parts, count);
+    return 0;
 }
\ No newline at end of file
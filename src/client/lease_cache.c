@@ -0,0 +1,112 @@
+#include "client.h"
+
+// The NM answers READ/WRITE/STREAM/UNDO with "202 OK ip:port LEASE <sec>".
+// Until the lease runs out, the same operation on the same file goes straight
+// to that SS. The NM pushes "<LEASE_REVOKE_MARKER>REVOKE <file>\n" on our NM
+// socket when the answer changes; those pushes can arrive while we are idle
+// or just before or after any reply, so every read from the NM filters them out.
+
+static LeaseEntry* find_lease(Client* client, const char* filename, char mode) {
+    time_t now = time(NULL);
+    LeaseEntry** link = &client->leases;
+    LeaseEntry* found = NULL;
+    while (*link) {
+        LeaseEntry* l = *link;
+        if (l->expires <= now) {
+            *link = l->next;
+            free(l);
+            continue;
+        }
+        if (!found && strcmp(l->filename, filename) == 0 && (l->mode == mode || l->mode == 'W')) {
+            found = l;
+        }
+        link = &l->next;
+    }
+    return found;
+}
+
+LeaseEntry* client_lease_lookup(Client* client, const char* filename, char mode) {
+    return find_lease(client, filename, mode);
+}
+
+void client_lease_store(Client* client, const char* filename, char mode, const char* ss_addr, const char* token, int seconds) {
+    if (seconds <= 1) return;
+    LeaseEntry* l = (LeaseEntry*)calloc(1, sizeof(LeaseEntry));
+    if (!l) return;
+    strncpy(l->filename, filename, MAX_FILENAME_LEN - 1);
+    strncpy(l->ss_addr, ss_addr, sizeof(l->ss_addr) - 1);
+    strncpy(l->token, token, sizeof(l->token) - 1);
+    l->mode = mode;
+    l->expires = time(NULL) + seconds - 1; // Stay on the safe side of the NM's clock
+    l->next = client->leases;
+    client->leases = l;
+}
+
+void client_lease_drop(Client* client, const char* filename) {
+    LeaseEntry** link = &client->leases;
+    while (*link) {
+        LeaseEntry* l = *link;
+        if (strcmp(l->filename, filename) == 0) {
+            *link = l->next;
+            free(l);
+        } else {
+            link = &l->next;
+        }
+    }
+}
+
+void client_lease_free_all(Client* client) {
+    while (client->leases) {
+        LeaseEntry* next = client->leases->next;
+        free(client->leases);
+        client->leases = next;
+    }
+}
+
+// Removes every complete REVOKE push from 'buffer' (applying it) and returns
+// the new length. A push cut off by the end of the buffer is completed first.
+static int strip_revocations(Client* client, char* buffer, int len) {
+    char* mark;
+    while ((mark = memchr(buffer, LEASE_REVOKE_MARKER, len)) != NULL) {
+        char* end = memchr(mark, '\n', len - (mark - buffer));
+        while (!end && len < BUFFER_SIZE - 1) {
+            int more = recv(client->nm_sock, buffer + len, BUFFER_SIZE - 1 - len, 0);
+            if (more <= 0) break;
+            len += more;
+            buffer[len] = '\0';
+            end = memchr(mark, '\n', len - (mark - buffer));
+        }
+        if (!end) {
+            len = mark - buffer; // Unterminated; drop the fragment
+            break;
+        }
+        *end = '\0';
+        if (strncmp(mark + 1, "REVOKE ", 7) == 0) {
+            client_lease_drop(client, mark + 8);
+        }
+        int tail = len - (int)(end + 1 - buffer);
+        memmove(mark, end + 1, tail);
+        len = (int)(mark - buffer) + tail;
+    }
+    buffer[len] = '\0';
+    return len;
+}
+
+void client_drain_revocations(Client* client) {
+    char buffer[BUFFER_SIZE];
+    int bytes;
+    while ((bytes = recv(client->nm_sock, buffer, BUFFER_SIZE - 1, MSG_DONTWAIT)) > 0) {
+        buffer[bytes] = '\0';
+        strip_revocations(client, buffer, bytes); // Anything else here is a stray tail; drop it
+    }
+}
+
+int client_recv_nm(Client* client, char* buffer) {
+    while (1) {
+        int bytes = recv_message(client->nm_sock, buffer);
+        if (bytes <= 0) return bytes;
+        bytes = strip_revocations(client, buffer, bytes);
+        if (bytes > 0) return bytes;
+        // Only pushes so far; the reply is still on its way
+    }
+}
@@ -0,0 +1,105 @@
+#include "capability.h"
+
+static uint64_t cap_k0, cap_k1;
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                   \
+    do {                                                           \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                     \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                     \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+// SipHash-2-4 of 'len' bytes under the 128-bit key (k0, k1).
+static uint64_t siphash24(uint64_t k0, uint64_t k1, const unsigned char* in, size_t len) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t b = ((uint64_t)len) << 56;
+    size_t full = len - (len % 8);
+
+    for (size_t i = 0; i < full; i += 8) {
+        uint64_t m = 0;
+        for (int j = 0; j < 8; j++) m |= ((uint64_t)in[i + j]) << (8 * j);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    for (size_t j = 0; j < len % 8; j++) b |= ((uint64_t)in[full + j]) << (8 * j);
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+int cap_init_key(const char* component) {
+    const char* secret = getenv(CAP_KEY_ENV);
+    if (!secret || secret[0] == '\0') {
+        const char* dev = getenv(CAP_DEV_KEY_ENV);
+        char log_buf[BUFFER_SIZE];
+        if (!dev || strcmp(dev, "1") != 0) {
+            snprintf(log_buf, sizeof(log_buf), "ERROR: %s is not set; refusing to start without a signing key "
+                     "(set %s=1 to use the public development key).", CAP_KEY_ENV, CAP_DEV_KEY_ENV);
+            log_message(component, log_buf);
+            return -1;
+        }
+        secret = "langos-development-key";
+        snprintf(log_buf, sizeof(log_buf), "ERROR: %s is not set and %s=1; using the public development key. "
+                 "Anyone can mint tokens; never run this way outside development.", CAP_KEY_ENV, CAP_DEV_KEY_ENV);
+        log_message(component, log_buf);
+    }
+    // Stretch the passphrase into a 128-bit key
+    size_t len = strlen(secret);
+    cap_k0 = siphash24(0x0123456789abcdefULL, 0xfedcba9876543210ULL, (const unsigned char*)secret, len);
+    cap_k1 = siphash24(cap_k0, 0x5a5a5a5a5a5a5a5aULL, (const unsigned char*)secret, len);
+    return 0;
+}
+
+static uint64_t sign(const char* body) {
+    return siphash24(cap_k0, cap_k1, (const unsigned char*)body, strlen(body));
+}
+
+void cap_issue(const char* user, const char* filename, char perm, int ttl_sec, char* out, int out_size) {
+    char body[CAP_TOKEN_LEN];
+    snprintf(body, sizeof(body), "%c:%ld:%s:%s", perm, (long)(time(NULL) + ttl_sec), user, filename);
+    snprintf(out, out_size, "%016llx:%s", (unsigned long long)sign(body), body);
+}
+
+int cap_verify(const char* token, const char* filename, char perm, char* user_out, int user_size) {
+    // <sig>:<perm>:<expiry>:<user>:<file>
+    if (!token || strlen(token) < 20 || token[16] != ':') return 0;
+    const char* body = token + 17;
+    char token_perm = body[0];
+    if (body[1] != ':') return 0;
+    char* end = NULL;
+    long expiry = strtol(body + 2, &end, 10);
+    if (!end || *end != ':') return 0;
+    const char* user = end + 1;
+    const char* sep = strchr(user, ':');
+    if (!sep || sep == user) return 0;
+    const char* token_file = sep + 1;
+
+    if (strcmp(token_file, filename) != 0) return 0;
+    if (!(token_perm == perm || (token_perm == 'W' && perm == 'R'))) return 0;
+    if (expiry < time(NULL)) return 0;
+
+    unsigned long long sig = strtoull(token, &end, 16);
+    if (end != token + 16 || sig != (unsigned long long)sign(body)) return 0;
+
+    if (user_out) {
+        int n = (int)(sep - user) < user_size - 1 ? (int)(sep - user) : user_size - 1;
+        memcpy(user_out, user, n);
+        user_out[n] = '\0';
+    }
+    return 1;
+}
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "text_scan.h"
 
 pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -49,6 +50,66 @@ int recv_message(int sock, char* buffer) {
     return bytes_read;
 }
 
+void line_reader_init(LineReader* reader, int sock) {
+    reader->sock = sock;
+    reader->len = 0;
+}
+
+// Returns the length of the next line (without '\n'), 0 on close, -1 on error.
+// Empty lines are skipped. A line longer than the buffer is returned in pieces.
+int recv_line(LineReader* reader, char* line, int line_size) {
+    while (1) {
+        char* nl = memchr(reader->buf, '\n', reader->len);
+        if (nl || reader->len == (int)sizeof(reader->buf)) {
+            int line_len = nl ? (int)(nl - reader->buf) : reader->len;
+            int consumed = nl ? line_len + 1 : line_len;
+            int copy_len = line_len < line_size - 1 ? line_len : line_size - 1;
+            memcpy(line, reader->buf, copy_len);
+            line[copy_len] = '\0';
+            memmove(reader->buf, reader->buf + consumed, reader->len - consumed);
+            reader->len -= consumed;
+            if (copy_len > 0 && line[copy_len - 1] == '\r') line[--copy_len] = '\0';
+            if (copy_len == 0) continue; // Skip blank lines
+            return copy_len;
+        }
+
+        int bytes_read = recv(reader->sock, reader->buf + reader->len, sizeof(reader->buf) - reader->len, 0);
+        if (bytes_read < 0) {
+            if (errno != ECONNRESET && errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recv"); // A receive timeout is the caller's business
+            }
+            return -1;
+        } else if (bytes_read == 0) {
+            return 0;
+        }
+        reader->len += bytes_read;
+    }
+}
+
+// Sends 'message' followed by '\n', retrying on short writes.
+int send_line(int sock, const char* message) {
+    size_t len = strlen(message);
+    char* framed = malloc(len + 2);
+    if (!framed) return -1;
+    memcpy(framed, message, len);
+    framed[len] = '\n';
+    framed[len + 1] = '\0';
+
+    size_t sent = 0;
+    while (sent < len + 1) {
+        ssize_t n = send(sock, framed + sent, len + 1 - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("send");
+            free(framed);
+            return -1;
+        }
+        sent += n;
+    }
+    free(framed);
+    return 0;
+}
+
 int create_listener_socket(int port) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
@@ -87,6 +148,29 @@ void trim_newline(char* str) {
     str[strcspn(str, "\r\n")] = 0;
 }
 
+const char* skip_words(const char* str, int n) {
+    for (int i = 0; i < n; i++) {
+        str += strspn(str, " ");
+        str += strcspn(str, " ");
+    }
+    return *str == ' ' ? str + 1 : str;
+}
+
+// Both compare 64-byte blocks with memcmp until one differs, then bytes.
+long common_prefix(const char* a, const char* b, long n) {
+    long i = 0;
+    while (i + 64 <= n && memcmp(a + i, b + i, 64) == 0) i += 64;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+long common_suffix(const char* a_end, const char* b_end, long n) {
+    long i = 0;
+    while (i + 64 <= n && memcmp(a_end - i - 64, b_end - i - 64, 64) == 0) i += 64;
+    while (i < n && a_end[-1 - i] == b_end[-1 - i]) i++;
+    return i;
+}
+
 char** split_string(const char* str, const char* delim, int* count) {
     *count = 0;
     char* str_copy = strdup(str);
@@ -151,22 +235,20 @@ char* get_file_content(const char* filepath) {
 int get_word_count(const char* filepath) {
     FILE* f = fopen(filepath, "r");
     if (!f) return 0;
-    int count = 0;
+    char chunk[65536];
+    long count = 0;
     int in_word = 0;
-    char c;
-    while ((c = fgetc(f)) != EOF) {
-        if (isspace(c) || c == '.' || c == '!' || c == '?') {
-            if (in_word) {
-                count++;
-                in_word = 0;
-            }
-        } else {
-            in_word = 1;
-        }
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        count += text_count_words(chunk, (long)n, &in_word);
     }
-    if (in_word) count++; // Last word
     fclose(f);
-    return count;
+    return (int)count;
+}
+
+// Same rule as get_word_count, over an in-memory buffer.
+int count_words(const char* content, long len) {
+    return (int)text_count_words(content, len, NULL);
 }
 
 int get_char_count(const char* filepath) {
@@ -174,6 +174,14 @@ void free_access_list(AccessNode* head) {
     }
 }
 
+void free_lease_list(LeaseNode* head) {
+    while (head) {
+        LeaseNode* next = head->next;
+        free(head);
+        head = next;
+    }
+}
+
 void format_access_list(AccessNode* head, char* buffer) {
     AccessNode* curr = head;
     buffer[0] = '\0';
@@ -252,6 +260,20 @@ FileMetadata* ht_get(HashTable* table, const char* filename) {
     return NULL; // Not found
 }
 
+FileMetadata* ht_get_locked(HashTable* table, const char* filename) {
+    unsigned int index = hash_function(filename);
+
+    pthread_mutex_lock(&table->lock);
+    HTNode* curr = table->buckets[index];
+    while (curr && strcmp(curr->metadata->filename, filename) != 0) {
+        curr = curr->next;
+    }
+    FileMetadata* meta = curr ? curr->metadata : NULL;
+    if (meta) pthread_mutex_lock(&meta->lock);
+    pthread_mutex_unlock(&table->lock);
+    return meta;
+}
+
 void ht_delete(HashTable* table, const char* filename) {
     unsigned int index = hash_function(filename);
     
@@ -267,9 +289,12 @@ void ht_delete(HashTable* table, const char* filename) {
                 table->buckets[index] = curr->next;
             }
             
-            // Free the metadata and the node
+            // Free the metadata and the node, once whoever holds it is done
+            pthread_mutex_lock(&curr->metadata->lock);
+            pthread_mutex_unlock(&curr->metadata->lock);
             pthread_mutex_destroy(&curr->metadata->lock);
             free_access_list(curr->metadata->access_list_head);
+            free_lease_list(curr->metadata->leases);
             free(curr->metadata);
             free(curr);
             
@@ -294,6 +319,7 @@ void ht_free(HashTable* table) {
             HTNode* next = curr->next;
             pthread_mutex_destroy(&curr->metadata->lock);
             free_access_list(curr->metadata->access_list_head);
+            free_lease_list(curr->metadata->leases);
             free(curr->metadata);
             free(curr);
             curr = next;
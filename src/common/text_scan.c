@@ -0,0 +1,191 @@
+#include "text_scan.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXT_SCAN_X86 1
+#endif
+
+#define TEXT_BLOCK 64 // Bytes classified per kernel call; one bit each in the masks
+
+// Sets bit i of *space / *delim when p[i] is whitespace / a delimiter.
+typedef void (*ClassifyFn)(const char* p, uint64_t* space, uint64_t* delim);
+
+static ClassifyFn classify_block; // NULL: byte-at-a-time only
+static const char* classify_name = "scalar";
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static inline int is_space_byte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_delim_byte(unsigned char c) {
+    return c == '.' || c == '!' || c == '?';
+}
+
+#ifdef TEXT_SCAN_X86
+// '\t'..'\r' are the bytes with (c - '\t') <= 4 unsigned; SSE2 has no
+// unsigned compare, so that is tested as min(x, 4) == x.
+static void classify_sse2(const char* p, uint64_t* space, uint64_t* delim) {
+    const __m128i blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), four = _mm_set1_epi8(4);
+    const __m128i dot = _mm_set1_epi8('.'), bang = _mm_set1_epi8('!'), quest = _mm_set1_epi8('?');
+    uint64_t s = 0, d = 0;
+    for (int i = 0; i < TEXT_BLOCK; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i off = _mm_sub_epi8(x, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, blank), _mm_cmpeq_epi8(_mm_min_epu8(off, four), off));
+        __m128i dl = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, dot), _mm_cmpeq_epi8(x, bang)),
+                                  _mm_cmpeq_epi8(x, quest));
+        s |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+        d |= (uint64_t)(uint16_t)_mm_movemask_epi8(dl) << i;
+    }
+    *space = s;
+    *delim = d;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* p, uint64_t* space, uint64_t* delim) {
+    const __m256i blank = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), four = _mm256_set1_epi8(4);
+    const __m256i dot = _mm256_set1_epi8('.'), bang = _mm256_set1_epi8('!'), quest = _mm256_set1_epi8('?');
+    uint64_t s = 0, d = 0;
+    for (int i = 0; i < TEXT_BLOCK; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i off = _mm256_sub_epi8(x, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(x, blank),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(off, four), off));
+        __m256i dl = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, dot), _mm256_cmpeq_epi8(x, bang)),
+                                     _mm256_cmpeq_epi8(x, quest));
+        s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+        d |= (uint64_t)(uint32_t)_mm256_movemask_epi8(dl) << i;
+    }
+    *space = s;
+    *delim = d;
+}
+#endif
+
+static void classify_init(void) {
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        classify_block = classify_avx2;
+        classify_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        classify_block = classify_sse2;
+        classify_name = "sse2";
+    }
+#endif
+}
+
+static ClassifyFn kernel(void) {
+    pthread_once(&classify_once, classify_init);
+    return classify_block;
+}
+
+const char* text_scan_impl(void) {
+    kernel();
+    return classify_name;
+}
+
+int text_scan_use(const char* impl) {
+    kernel();
+    if (strcmp(impl, "scalar") == 0) {
+        classify_block = NULL;
+        classify_name = "scalar";
+        return 0;
+    }
+#ifdef TEXT_SCAN_X86
+    if (strcmp(impl, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        classify_block = classify_avx2;
+        classify_name = "avx2";
+        return 0;
+    }
+    if (strcmp(impl, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        classify_block = classify_sse2;
+        classify_name = "sse2";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+// Each scan runs whole blocks through the kernel and finishes the tail (or
+// everything, without a kernel) a byte at a time.
+
+long text_find_delimiter(const char* data, long len) {
+    ClassifyFn classify = kernel();
+    long i = 0;
+    for (; classify && i + TEXT_BLOCK <= len; i += TEXT_BLOCK) {
+        uint64_t space, delim;
+        classify(data + i, &space, &delim);
+        if (delim) return i + __builtin_ctzll(delim);
+    }
+    while (i < len && !is_delim_byte(data[i])) i++;
+    return i;
+}
+
+long text_find_separator(const char* data, long len) {
+    ClassifyFn classify = kernel();
+    long i = 0;
+    for (; classify && i + TEXT_BLOCK <= len; i += TEXT_BLOCK) {
+        uint64_t space, delim;
+        classify(data + i, &space, &delim);
+        if (space | delim) return i + __builtin_ctzll(space | delim);
+    }
+    while (i < len && !is_space_byte(data[i]) && !is_delim_byte(data[i])) i++;
+    return i;
+}
+
+long text_skip_space(const char* data, long len) {
+    ClassifyFn classify = kernel();
+    long i = 0;
+    for (; classify && i + TEXT_BLOCK <= len; i += TEXT_BLOCK) {
+        uint64_t space, delim;
+        classify(data + i, &space, &delim);
+        if (~space) return i + __builtin_ctzll(~space);
+    }
+    while (i < len && is_space_byte(data[i])) i++;
+    return i;
+}
+
+long text_skip_separators(const char* data, long len) {
+    ClassifyFn classify = kernel();
+    long i = 0;
+    for (; classify && i + TEXT_BLOCK <= len; i += TEXT_BLOCK) {
+        uint64_t space, delim;
+        classify(data + i, &space, &delim);
+        if (~(space | delim)) return i + __builtin_ctzll(~(space | delim));
+    }
+    while (i < len && (is_space_byte(data[i]) || is_delim_byte(data[i]))) i++;
+    return i;
+}
+
+long text_count_words(const char* data, long len, int* in_word) {
+    ClassifyFn classify = kernel();
+    int inside = in_word ? *in_word : 0;
+    long count = 0, i = 0;
+    if (classify && len >= TEXT_BLOCK) {
+        // A word starts wherever a non-separator follows a separator
+        uint64_t carry = !inside;
+        for (; i + TEXT_BLOCK <= len; i += TEXT_BLOCK) {
+            uint64_t space, delim;
+            classify(data + i, &space, &delim);
+            uint64_t sep = space | delim;
+            count += __builtin_popcountll(~sep & ((sep << 1) | carry));
+            carry = sep >> 63;
+        }
+        inside = !carry;
+    }
+    for (; i < len; i++) {
+        unsigned char c = data[i];
+        if (is_space_byte(c) || is_delim_byte(c)) {
+            inside = 0;
+        } else if (!inside) {
+            inside = 1;
+            count++;
+        }
+    }
+    if (in_word) *in_word = inside;
+    return count;
+}
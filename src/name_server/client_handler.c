@@ -6,8 +6,10 @@ void add_client(NameServer* nm, int sock, const char* username) {
     ClientInfo* new_client = (ClientInfo*)malloc(sizeof(ClientInfo));
     new_client->socket = sock;
     strncpy(new_client->username, username, MAX_USERNAME_LEN - 1);
+    pthread_mutex_init(&new_client->send_mutex, NULL);
     
     pthread_mutex_lock(&nm->client_list_mutex);
+    new_client->session_id = ++nm->next_session_id;
     new_client->next = nm->client_list_head;
     nm->client_list_head = new_client;
     pthread_mutex_unlock(&nm->client_list_mutex);
@@ -31,6 +33,7 @@ void remove_client(NameServer* nm, int sock) {
                 nm->client_list_head = curr->next;
             }
             strncpy(username, curr->username, MAX_USERNAME_LEN - 1);
+            pthread_mutex_destroy(&curr->send_mutex);
             free(curr);
             break;
         }
@@ -49,6 +52,19 @@ void remove_client(NameServer* nm, int sock) {
 
 // ... nm_handle_client_request() is UNCHANGED ...
 // (It already calls add_client and nm_register_persistent_user)
+int nm_reply(NameServer* nm, int client_sock, const char* message) {
+    pthread_mutex_lock(&nm->client_list_mutex);
+    ClientInfo* c = nm->client_list_head;
+    while (c && c->socket != client_sock) c = c->next;
+    // Only this client's own thread replies to it or removes it, so 'c'
+    // stays valid once the list is released
+    if (c) pthread_mutex_lock(&c->send_mutex);
+    pthread_mutex_unlock(&nm->client_list_mutex);
+    int rc = send_message(client_sock, message);
+    if (c) pthread_mutex_unlock(&c->send_mutex);
+    return rc;
+}
+
 void* nm_handle_client_request(void* arg) {
     NM_ConnArgs* args = (NM_ConnArgs*)arg;
     NameServer* nm = args->nm;
@@ -69,7 +85,7 @@ void* nm_handle_client_request(void* arg) {
     
     if (count < 2 || strcmp(parts[0], "INIT_CLIENT") != 0) {
         log_message("NM", "Invalid INIT_CLIENT message.");
-        send_message(client_sock, "400 ERROR: Invalid INIT_CLIENT");
+        nm_reply(nm, client_sock, "400 ERROR: Invalid INIT_CLIENT");
         close(client_sock);
         free_split_string(parts, count);
         free(arg);
@@ -105,7 +121,8 @@ void* nm_handle_client_request(void* arg) {
             handle_create_delete(nm, client_sock, username, args, arg_count, 1);
         } else if (strcmp(cmd, "DELETE") == 0) {
             handle_create_delete(nm, client_sock, username, args, arg_count, 0);
-        } else if (strcmp(cmd, "READ") == 0 || strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "STREAM") == 0 || strcmp(cmd, "UNDO") == 0) {
+        } else if (strcmp(cmd, "READ") == 0 || strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "STREAM") == 0 ||
+                   strcmp(cmd, "APPEND") == 0 || strcmp(cmd, "UNDO") == 0 || strcmp(cmd, "HISTORY") == 0) {
             handle_read_write_stream(nm, client_sock, username, args, arg_count);
         } else if (strcmp(cmd, "INFO") == 0) {
             handle_info(nm, client_sock, username, args, arg_count);
@@ -116,7 +133,7 @@ void* nm_handle_client_request(void* arg) {
         } else if (strcmp(cmd, "LIST") == 0) {
             handle_list(nm, client_sock);
         } else {
-            send_message(client_sock, "400 ERROR: Unknown command.");
+            nm_reply(nm, client_sock, "400 ERROR: Unknown command.");
         }
         
         free_split_string(args, arg_count);
@@ -224,14 +241,42 @@ void handle_view(NameServer* nm, int client_sock, const char* username, char** a
         strcat(response, "(No files to display)\n");
     }
     
-    send_message(client_sock, response);
+    nm_reply(nm, client_sock, response);
 }
 
 
+// Sends 'message' as a tracked request to every SS in 'targets' and waits for
+// all of them. status[i] gets each SS's answer; 'detail' the first failure's text.
+static void send_and_wait_all(NameServer* nm, StorageServerInfo* targets, int count, const char* filename,
+                              const char* message, int* status, char* detail, int detail_size) {
+    PendingOp* ops[MAX_REPLICAS + 1];
+    char op_detail[512];
+    detail[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        ops[i] = nm_pending_create(filename, NULL);
+        if (nm_send_tracked(nm, targets[i].ip, targets[i].client_port, ops[i], message) < 0) {
+            nm_pending_free(ops[i]);
+            ops[i] = NULL;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (ops[i]) {
+            status[i] = nm_wait_request(nm, ops[i], SS_ACK_TIMEOUT_SEC, op_detail, sizeof(op_detail));
+        } else {
+            status[i] = ERROR_SS_UNAVAILABLE;
+            strncpy(op_detail, "Storage server is not connected.", sizeof(op_detail));
+        }
+        if (status[i] != MSG_SUCCESS && detail[0] == '\0') {
+            strncpy(detail, op_detail, detail_size - 1);
+            detail[detail_size - 1] = '\0';
+        }
+    }
+}
+
 // handle_create_delete() is UPDATED
 void handle_create_delete(NameServer* nm, int client_sock, const char* username, char** args, int arg_count, int is_create) {
     if (arg_count < 2) {
-        send_message(client_sock, "400 ERROR: Usage: CREATE/DELETE <filename>");
+        nm_reply(nm, client_sock, "400 ERROR: Usage: CREATE/DELETE <filename>");
         return;
     }
     const char* filename = args[1];
@@ -240,39 +285,89 @@ void handle_create_delete(NameServer* nm, int client_sock, const char* username,
     if (is_create) {
         // --- CREATE ---
         if (ht_get(nm->file_table, filename) != NULL) {
-            send_message(client_sock, "409 ERROR: File already exists.");
+            nm_reply(nm, client_sock, "409 ERROR: File already exists.");
             return;
         }
         
-        StorageServerInfo* ss = get_ss_for_new_file(nm);
-        if (!ss) {
-            send_message(client_sock, "503 ERROR: No storage servers available.");
+        StorageServerInfo targets[MAX_REPLICAS + 1];
+        int max_copies = nm->replication_factor < MAX_REPLICAS + 1 ? nm->replication_factor : MAX_REPLICAS + 1;
+        int target_count = get_ss_for_new_file(nm, targets, max_copies);
+        if (target_count == 0) {
+            nm_reply(nm, client_sock, "503 ERROR: No storage servers available.");
             return;
         }
+        StorageServerInfo* ss = &targets[0];
         
         FileMetadata* meta = (FileMetadata*)calloc(1, sizeof(FileMetadata));
         strncpy(meta->filename, filename, MAX_FILENAME_LEN - 1);
         strncpy(meta->owner, username, MAX_USERNAME_LEN - 1);
         strncpy(meta->ss_ip, ss->ip, MAX_IP_LEN - 1);
         meta->ss_client_port = ss->client_port;
+        for (int i = 1; i < target_count; i++) {
+            ReplicaInfo* r = &meta->replicas[meta->replica_count++];
+            strncpy(r->ip, targets[i].ip, MAX_IP_LEN - 1);
+            r->client_port = targets[i].client_port;
+            r->synced_version = 0; // Empty file on every copy
+        }
         meta->access_list_head = NULL;
         add_access(&meta->access_list_head, username, 'W'); // Add owner
         meta->created_at = time(NULL);
         meta->last_modified = time(NULL);
         meta->last_accessed = time(NULL);
+        meta->busy = 1; // Not migrated until every copy exists
         pthread_mutex_init(&meta->lock, NULL);
         
-        // Send command to SS
+        // Reserve the name before any SS is touched
+        if (!ht_insert(nm->file_table, meta)) {
+            pthread_mutex_destroy(&meta->lock);
+            free_access_list(meta->access_list_head);
+            free(meta);
+            nm_reply(nm, client_sock, "409 ERROR: File already exists.");
+            return;
+        }
+
+        // Create on the primary and every replica in parallel, then collect results
         char cmd_buf[BUFFER_SIZE];
+        char detail[512];
+        int status[MAX_REPLICAS + 1];
         snprintf(cmd_buf, sizeof(cmd_buf), "CREATE %s", filename);
-        
-        send_message(ss->socket, cmd_buf);
-        
-        ht_insert(nm->file_table, meta);
+        send_and_wait_all(nm, targets, target_count, filename, cmd_buf, status, detail, sizeof(detail));
+
+        if (status[0] != MSG_SUCCESS) {
+            // The primary refused: undo the reservation and any replica copies
+            ht_delete(nm->file_table, filename);
+            snprintf(cmd_buf, sizeof(cmd_buf), "DELETE %s", filename);
+            for (int i = 1; i < target_count; i++) {
+                if (status[i] != MSG_SUCCESS) continue;
+                PendingOp* op = nm_pending_create(filename, nm_log_request_result);
+                if (nm_send_tracked(nm, targets[i].ip, targets[i].client_port, op, cmd_buf) < 0) nm_pending_free(op);
+            }
+            char response[BUFFER_SIZE];
+            snprintf(response, sizeof(response), "%d ERROR: Storage server could not create the file: %s", status[0], detail);
+            nm_reply(nm, client_sock, response);
+            snprintf(log_buf, sizeof(log_buf), "CREATE '%s' failed on SS %s:%d: %d %s", filename, ss->ip, ss->client_port, status[0], detail);
+            log_message("NM", log_buf);
+            return;
+        }
+
+        // Keep only the replicas that actually hold the file
+        int replicas_ok = 0;
+        meta = ht_get(nm->file_table, filename);
+        if (meta) {
+            pthread_mutex_lock(&meta->lock);
+            int kept = 0;
+            for (int i = 0; i < meta->replica_count; i++) {
+                if (status[i + 1] == MSG_SUCCESS) meta->replicas[kept++] = meta->replicas[i];
+            }
+            meta->replica_count = kept;
+            replicas_ok = kept;
+            meta->busy = 0;
+            pthread_mutex_unlock(&meta->lock);
+        }
         trie_insert(nm->file_trie, filename);
         
-        send_message(client_sock, "201 OK: File created successfully!");
-        snprintf(log_buf, sizeof(log_buf), "User '%s' created file '%s' on SS %s:%d", username, filename, ss->ip, ss->client_port);
+        nm_reply(nm, client_sock, "201 OK: File created successfully!");
+        snprintf(log_buf, sizeof(log_buf), "User '%s' created file '%s' on SS %s:%d (%d replica(s))", username, filename, ss->ip, ss->client_port, replicas_ok);
         
         // --- UPDATED CALL ---
         nm_save_files(nm); 
@@ -282,39 +377,76 @@ void handle_create_delete(NameServer* nm, int client_sock, const char* username,
         // --- DELETE ---
         FileMetadata* meta = ht_get(nm->file_table, filename);
         if (!meta) {
-            send_message(client_sock, "404 ERROR: File not found.");
+            nm_reply(nm, client_sock, "404 ERROR: File not found.");
             return;
         }
         
         if (strcmp(meta->owner, username) != 0) {
-            send_message(client_sock, "401 ERROR: Only the owner can delete a file.");
+            nm_reply(nm, client_sock, "401 ERROR: Only the owner can delete a file.");
             return;
         }
         
-        // Find SS and send command
-        pthread_mutex_lock(&nm->ss_list_mutex);
-        StorageServerInfo* ss = nm->ss_list_head;
-        int ss_sock = -1;
-        while(ss) {
-            if (strcmp(ss->ip, meta->ss_ip) == 0 && ss->client_port == meta->ss_client_port) {
-                ss_sock = ss->socket;
-                break;
-            }
-            ss = ss->next;
+        // A migration keeps using this entry while it waits on the SSes, so
+        // it can't be freed under one; and none may start once this is under way
+        pthread_mutex_lock(&meta->lock);
+        if (meta->migration.active || meta->busy) {
+            pthread_mutex_unlock(&meta->lock);
+            nm_reply(nm, client_sock, meta->busy ? "423 ERROR: File is being created or deleted, retry shortly."
+                                                 : "423 ERROR: File is being migrated, retry shortly.");
+            return;
         }
-        pthread_mutex_unlock(&nm->ss_list_mutex);
+        meta->busy = 1;
 
-        if (ss_sock != -1) {
-            char cmd_buf[BUFFER_SIZE];
-            snprintf(cmd_buf, sizeof(cmd_buf), "DELETE %s", filename);
-            send_message(ss_sock, cmd_buf);
+        // Delete on the primary and every replica that is online
+        char cmd_buf[BUFFER_SIZE];
+        snprintf(cmd_buf, sizeof(cmd_buf), "DELETE %s", filename);
+        StorageServerInfo copies[MAX_REPLICAS + 1];
+        int copy_count = 0;
+        int primary_online = 0;
+        if (is_ss_online(nm, meta->ss_ip, meta->ss_client_port)) {
+            strncpy(copies[copy_count].ip, meta->ss_ip, MAX_IP_LEN);
+            copies[copy_count++].client_port = meta->ss_client_port;
+            primary_online = 1;
+        }
+        for (int i = 0; i < meta->replica_count; i++) {
+            if (!is_ss_online(nm, meta->replicas[i].ip, meta->replicas[i].client_port)) continue;
+            strncpy(copies[copy_count].ip, meta->replicas[i].ip, MAX_IP_LEN);
+            copies[copy_count++].client_port = meta->replicas[i].client_port;
+        }
+        pthread_mutex_unlock(&meta->lock);
+
+        char detail[512];
+        int status[MAX_REPLICAS + 1];
+        send_and_wait_all(nm, copies, copy_count, filename, cmd_buf, status, detail, sizeof(detail));
+
+        // A primary that still holds the file keeps it registered; a replica
+        // that already lost it (404) or fails now only leaves an orphan behind.
+        if (primary_online && status[0] != MSG_SUCCESS && status[0] != ERROR_FILE_NOT_FOUND) {
+            char response[BUFFER_SIZE];
+            snprintf(response, sizeof(response), "%d ERROR: Storage server could not delete the file: %s", status[0], detail);
+            pthread_mutex_lock(&meta->lock);
+            meta->busy = 0;
+            pthread_mutex_unlock(&meta->lock);
+            nm_reply(nm, client_sock, response);
+            snprintf(log_buf, sizeof(log_buf), "DELETE '%s' failed on primary: %d %s", filename, status[0], detail);
+            log_message("NM", log_buf);
+            return;
+        }
+        for (int i = primary_online; i < copy_count; i++) {
+            if (status[i] != MSG_SUCCESS && status[i] != ERROR_FILE_NOT_FOUND) {
+                snprintf(log_buf, sizeof(log_buf), "DELETE '%s' failed on replica %s:%d (%d)", filename, copies[i].ip, copies[i].client_port, status[i]);
+                log_message("NM", log_buf);
+            }
         }
         
         // Delete from data structures
+        pthread_mutex_lock(&meta->lock);
+        nm_revoke_leases(nm, meta, 0);
+        pthread_mutex_unlock(&meta->lock);
         ht_delete(nm->file_table, filename);
         trie_delete(nm->file_trie, filename);
         
-        send_message(client_sock, "200 OK: File deleted successfully.");
+        nm_reply(nm, client_sock, "200 OK: File deleted successfully.");
         snprintf(log_buf, sizeof(log_buf), "User '%s' deleted file '%s'", username, filename);
         
         // --- UPDATED CALL ---
@@ -327,7 +459,7 @@ void handle_create_delete(NameServer* nm, int client_sock, const char* username,
 // ... handle_read_write_stream() and handle_info() are UNCHANGED ...
 void handle_read_write_stream(NameServer* nm, int client_sock, const char* username, char** args, int arg_count) {
     if (arg_count < 2) {
-        send_message(client_sock, "400 ERROR: Missing filename.");
+        nm_reply(nm, client_sock, "400 ERROR: Missing filename.");
         return;
     }
     const char* filename = args[1];
@@ -335,55 +467,75 @@ void handle_read_write_stream(NameServer* nm, int client_sock, const char* usern
     
     FileMetadata* meta = ht_get(nm->file_table, filename);
     if (!meta) {
-        send_message(client_sock, "404 ERROR: File not found.");
+        nm_reply(nm, client_sock, "404 ERROR: File not found.");
         return;
     }
 
     // Check permissions
     char perm = 'R';
-    if (strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "UNDO") == 0) {
+    if (strcmp(cmd, "WRITE") == 0 || strcmp(cmd, "APPEND") == 0 || strcmp(cmd, "UNDO") == 0) {
         perm = 'W';
     }
     
     if (check_access(meta, username, perm) == 0) {
         char err_buf[100];
         snprintf(err_buf, sizeof(err_buf), "401 ERROR: %c access denied.", perm);
-        send_message(client_sock, err_buf);
+        nm_reply(nm, client_sock, err_buf);
         return;
     }
 
     // Update access time
     pthread_mutex_lock(&meta->lock);
     meta->last_accessed = time(NULL);
+    meta->request_count++;
+    int write_fenced = (perm == 'W' && meta->migration.fence != 0);
     pthread_mutex_unlock(&meta->lock);
 
-    // Check if SS is online
+    if (write_fenced) {
+        nm_reply(nm, client_sock, "423 ERROR: File is being migrated, retry shortly.");
+        return;
+    }
+
+    // WRITE/APPEND/UNDO must hit the primary, and so must HISTORY (only the primary
+    // keeps it); READ/STREAM may use any in-sync copy
+    char ss_ip[MAX_IP_LEN];
+    int ss_port = 0;
     int is_online = 0;
-    pthread_mutex_lock(&nm->ss_list_mutex);
-    StorageServerInfo* ss = nm->ss_list_head;
-    while(ss) {
-        if (strcmp(ss->ip, meta->ss_ip) == 0 && ss->client_port == meta->ss_client_port) {
-            is_online = 1;
-            break;
-        }
-        ss = ss->next;
+    if (perm == 'W' || strcmp(cmd, "HISTORY") == 0) {
+        pthread_mutex_lock(&meta->lock);
+        strncpy(ss_ip, meta->ss_ip, MAX_IP_LEN);
+        ss_port = meta->ss_client_port;
+        pthread_mutex_unlock(&meta->lock);
+        is_online = is_ss_online(nm, ss_ip, ss_port);
+    } else {
+        is_online = nm_pick_read_location(nm, meta, ss_ip, &ss_port);
     }
-    pthread_mutex_unlock(&nm->ss_list_mutex);
     
     if (!is_online) {
-        send_message(client_sock, "503 ERROR: Storage server for this file is offline.");
+        nm_reply(nm, client_sock, "503 ERROR: Storage server for this file is offline.");
         return;
     }
     
+    nm_note_ss_request(nm, ss_ip, ss_port);
+
+    // Let the client reuse this location for a while without asking again
+    pthread_mutex_lock(&meta->lock);
+    int lease_sec = nm_grant_lease(nm, meta, client_sock, ss_ip, ss_port, perm);
+    pthread_mutex_unlock(&meta->lock);
+
+    // The SS checks this token itself; it lives as long as the lease
+    char token[CAP_TOKEN_LEN];
+    cap_issue(username, filename, perm, lease_sec > 0 ? lease_sec : CAP_TOKEN_TTL_SEC, token, sizeof(token));
+
     // All checks passed, send SS info to client
     char response[BUFFER_SIZE];
-    snprintf(response, sizeof(response), "202 OK %s:%d", meta->ss_ip, meta->ss_client_port);
-    send_message(client_sock, response);
+    snprintf(response, sizeof(response), "202 OK %s:%d LEASE %d TOKEN %s", ss_ip, ss_port, lease_sec, token);
+    nm_reply(nm, client_sock, response);
 }
 
 void handle_info(NameServer* nm, int client_sock, const char* username, char** args, int arg_count) {
     if (arg_count < 2) {
-        send_message(client_sock, "400 ERROR: Usage: INFO <filename>");
+        nm_reply(nm, client_sock, "400 ERROR: Usage: INFO <filename>");
         return;
     }
     const char* filename = args[1];
@@ -391,18 +543,18 @@ void handle_info(NameServer* nm, int client_sock, const char* username, char** a
     // Check cache first
     char* cached_info = lru_get(nm->search_cache, filename);
     if (cached_info) {
-        send_message(client_sock, cached_info);
+        nm_reply(nm, client_sock, cached_info);
         return;
     }
     
     FileMetadata* meta = ht_get(nm->file_table, filename);
     if (!meta) {
-        send_message(client_sock, "404 ERROR: File not found.");
+        nm_reply(nm, client_sock, "404 ERROR: File not found.");
         return;
     }
 
     if (check_access(meta, username, 'R') == 0) {
-        send_message(client_sock, "401 ERROR: Read access denied.");
+        nm_reply(nm, client_sock, "401 ERROR: Read access denied.");
         return;
     }
 
@@ -442,7 +594,7 @@ void handle_info(NameServer* nm, int client_sock, const char* username, char** a
     // Put in cache
     lru_put(nm->search_cache, filename, response);
     
-    send_message(client_sock, response);
+    nm_reply(nm, client_sock, response);
 }
 
 
@@ -469,7 +621,7 @@ void handle_access(NameServer* nm, int client_sock, const char* username, char**
         if (strcmp(args[1], "-W") == 0) perm = 'W';
 
         if (perm == '\0') {
-             send_message(client_sock, "400 ERROR: Invalid permission flag. Use -R or -W.");
+             nm_reply(nm, client_sock, "400 ERROR: Invalid permission flag. Use -R or -W.");
              return;
         }
 
@@ -482,19 +634,19 @@ void handle_access(NameServer* nm, int client_sock, const char* username, char**
         target_user = args[2];
     } else {
         // Invalid usage
-        send_message(client_sock, "400 ERROR: Usage:\n  ADDACCESS -R|-W <filename> <username>\n  REMACCESS <filename> <username>");
+        nm_reply(nm, client_sock, "400 ERROR: Usage:\n  ADDACCESS -R|-W <filename> <username>\n  REMACCESS <filename> <username>");
         return;
     }
     // --- END NEW PARSING LOGIC ---
     
     FileMetadata* meta = ht_get(nm->file_table, filename);
     if (!meta) {
-        send_message(client_sock, "404 ERROR: File not found.");
+        nm_reply(nm, client_sock, "404 ERROR: File not found.");
         return;
     }
     
     if (strcmp(meta->owner, username) != 0) {
-        send_message(client_sock, "401 ERROR: Only the owner can change permissions.");
+        nm_reply(nm, client_sock, "401 ERROR: Only the owner can change permissions.");
         return;
     }
     
@@ -502,11 +654,12 @@ void handle_access(NameServer* nm, int client_sock, const char* username, char**
     
     if (is_add) {
         add_access(&meta->access_list_head, target_user, perm);
-        send_message(client_sock, "200 OK: Access granted.");
+        nm_reply(nm, client_sock, "200 OK: Access granted.");
     } else { // REMACCESS
         remove_access(&meta->access_list_head, target_user);
-        send_message(client_sock, "200 OK: Access removed.");
+        nm_reply(nm, client_sock, "200 OK: Access removed.");
     }
+    nm_revoke_leases(nm, meta, 0); // Cached locations must be re-checked against the new ACL
     
     pthread_mutex_unlock(&meta->lock);
     nm_save_files(nm); // Persist changes
@@ -527,5 +680,5 @@ void handle_list(NameServer* nm, int client_sock) {
     
     pthread_mutex_unlock(&nm->all_users_mutex);
     
-    send_message(client_sock, response);
+    nm_reply(nm, client_sock, response);
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "name_server.h"
+
+// Client location leases.
+// Along with "202 OK ip:port" the NM hands out a lease: for LEASE_DURATION_SEC
+// the client may go straight to that SS for the same file and access mode.
+// Whenever the answer would change (the copy moves, a primary fails over, the
+// ACL changes, the file is deleted, a replica falls behind) the NM pushes
+// "<LEASE_REVOKE_MARKER>REVOKE <file>\n" to every holder. Expiry bounds the
+// damage of a revocation that gets lost.
+
+static long session_for_socket(NameServer* nm, int client_sock) {
+    long session_id = 0;
+    pthread_mutex_lock(&nm->client_list_mutex);
+    for (ClientInfo* c = nm->client_list_head; c; c = c->next) {
+        if (c->socket == client_sock) {
+            session_id = c->session_id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nm->client_list_mutex);
+    return session_id;
+}
+
+// Records a lease and returns its duration in seconds (0 = none granted).
+int nm_grant_lease(NameServer* nm, FileMetadata* meta, int client_sock, const char* ip, int client_port, char mode) {
+    long session_id = session_for_socket(nm, client_sock);
+    if (session_id == 0) return 0;
+    time_t now = time(NULL);
+
+    // Drop expired leases and any older one this session holds
+    LeaseNode** link = &meta->leases;
+    while (*link) {
+        LeaseNode* l = *link;
+        if (l->expires <= now || (l->session_id == session_id && l->mode == mode)) {
+            *link = l->next;
+            free(l);
+        } else {
+            link = &l->next;
+        }
+    }
+
+    LeaseNode* lease = (LeaseNode*)calloc(1, sizeof(LeaseNode));
+    if (!lease) return 0;
+    lease->session_id = session_id;
+    strncpy(lease->ip, ip, MAX_IP_LEN - 1);
+    lease->client_port = client_port;
+    lease->mode = mode;
+    lease->expires = now + LEASE_DURATION_SEC;
+    lease->next = meta->leases;
+    meta->leases = lease;
+    return LEASE_DURATION_SEC;
+}
+
+// Pushes a REVOKE to the session holding 'lease'. It runs under the client
+// list lock, so it never blocks: the client's send mutex (which keeps the
+// push from landing inside a reply) is only tried, and the send doesn't wait.
+// Returns 0 if it was delivered whole, -1 if nothing was sent, -2 if only part
+// was: the stream now holds a torn marker, so the session is shut down.
+static int send_revoke(NameServer* nm, const LeaseNode* lease, const char* msg) {
+    int rc = -1;
+    long len = (long)strlen(msg);
+    pthread_mutex_lock(&nm->client_list_mutex);
+    for (ClientInfo* c = nm->client_list_head; c; c = c->next) {
+        if (c->session_id != lease->session_id) continue;
+        if (pthread_mutex_trylock(&c->send_mutex) != 0) break; // A reply is being sent
+        ssize_t n = send(c->socket, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n == len) {
+            rc = 0;
+        } else if (n > 0) {
+            shutdown(c->socket, SHUT_RDWR); // Its handler thread cleans up
+            rc = -2;
+        }
+        pthread_mutex_unlock(&c->send_mutex);
+        break;
+    }
+    pthread_mutex_unlock(&nm->client_list_mutex);
+    return rc;
+}
+
+// Revokes the leases on 'meta' (only those pointing at a replica if
+// 'replicas_only'). Pushes never block: a client that can't take the message
+// keeps its cached location until the lease expires.
+void nm_revoke_leases(NameServer* nm, FileMetadata* meta, int replicas_only) {
+    char msg[MAX_FILENAME_LEN + 16];
+    snprintf(msg, sizeof(msg), "%cREVOKE %s\n", LEASE_REVOKE_MARKER, meta->filename);
+    time_t now = time(NULL);
+
+    LeaseNode** link = &meta->leases;
+    while (*link) {
+        LeaseNode* l = *link;
+        int on_primary = (strcmp(l->ip, meta->ss_ip) == 0 && l->client_port == meta->ss_client_port);
+        if (replicas_only && on_primary && l->expires > now) {
+            link = &l->next;
+            continue;
+        }
+        *link = l->next;
+        int rc = (l->expires > now) ? send_revoke(nm, l, msg) : 0;
+        if (rc < 0) {
+            char log_buf[BUFFER_SIZE];
+            if (rc == -2) {
+                snprintf(log_buf, sizeof(log_buf), "REVOKE %s to session %ld cut short (client not reading); session disconnected",
+                         meta->filename, l->session_id);
+            } else {
+                snprintf(log_buf, sizeof(log_buf), "REVOKE %s to session %ld not delivered; lease dropped, the client's copy lapses in %lds",
+                         meta->filename, l->session_id, (long)(l->expires - now));
+            }
+            log_message("NM", log_buf);
+        }
+        free(l);
+    }
+}
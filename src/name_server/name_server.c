@@ -1,7 +1,7 @@
 #include "name_server.h"
 #include "persistence.h"
 
-NameServer* nm_create() {
+NameServer* nm_create(int replication_factor) {
     NameServer* nm = (NameServer*)calloc(1, sizeof(NameServer));
     if (!nm) {
         perror("malloc NameServer");
@@ -19,10 +19,14 @@ NameServer* nm_create() {
     pthread_mutex_init(&nm->client_list_mutex, NULL);
     pthread_mutex_init(&nm->ss_list_mutex, NULL);
     pthread_mutex_init(&nm->all_users_mutex, NULL);
+    pthread_cond_init(&nm->migration_cond, NULL);
+    pthread_mutex_init(&nm->pending_mutex, NULL);
+    nm->next_request_id = 1;
     
     nm->client_list_head = NULL;
     nm->ss_list_head = NULL;
     nm->all_users_list = NULL;
+    nm->replication_factor = replication_factor;
     
     // --- UPDATED CALLS ---
     nm_load_files(nm); 
@@ -45,6 +49,12 @@ void nm_run(NameServer* nm) {
     snprintf(log_buf, sizeof(log_buf), "Name Server listening on port %d...", NM_PORT);
     log_message("NM", log_buf);
 
+    // Background rebalancer (moves files between SSes)
+    pthread_t rebal_tid;
+    if (pthread_create(&rebal_tid, NULL, nm_rebalancer_thread, nm) == 0) {
+        pthread_detach(rebal_tid);
+    }
+
     while (1) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
@@ -155,13 +165,32 @@ void nm_free(NameServer* nm) {
     pthread_mutex_destroy(&nm->client_list_mutex);
     pthread_mutex_destroy(&nm->ss_list_mutex);
     pthread_mutex_destroy(&nm->all_users_mutex);
+    pthread_cond_destroy(&nm->migration_cond);
+    pthread_mutex_destroy(&nm->pending_mutex);
     
     free(nm);
 }
 
 
-int main() {
-    NameServer* nm = nm_create();
+int main(int argc, char* argv[]) {
+    int replication_factor = DEFAULT_REPLICATION_FACTOR;
+    if (argc > 2) {
+        fprintf(stderr, "Usage: ./bin/name_server [replication_factor]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        replication_factor = atoi(argv[1]);
+        if (replication_factor < 1 || replication_factor > MAX_REPLICAS + 1) {
+            fprintf(stderr, "Replication factor must be between 1 and %d\n", MAX_REPLICAS + 1);
+            return 1;
+        }
+    }
+
+    if (cap_init_key("NM") < 0) {
+        fprintf(stderr, "%s is not set (or set %s=1 for development)\n", CAP_KEY_ENV, CAP_DEV_KEY_ENV);
+        return 1;
+    }
+    NameServer* nm = nm_create(replication_factor);
     if (!nm) {
         fprintf(stderr, "Failed to create Name Server\n");
         return 1;
@@ -0,0 +1,163 @@
+#include "name_server.h"
+
+// In-flight NM->SS control requests, keyed by request id.
+// Every tracked message goes out as "#<id> <CMD> <args...>" and the SS
+// answers "ACK #<id> <status> [detail...]" whenever it is done, so any number
+// of requests can be outstanding per SS and replies may arrive out of order.
+
+static void pending_link(NameServer* nm, PendingOp* op) {
+    int b = op->id % PENDING_BUCKETS;
+    op->next = nm->pending_buckets[b];
+    nm->pending_buckets[b] = op;
+}
+
+// Caller holds pending_mutex. Returns the op, or NULL if it already completed.
+static PendingOp* pending_unlink(NameServer* nm, long id) {
+    int b = id % PENDING_BUCKETS;
+    PendingOp* curr = nm->pending_buckets[b];
+    PendingOp* prev = NULL;
+    while (curr) {
+        if (curr->id == id) {
+            if (prev) {
+                prev->next = curr->next;
+            } else {
+                nm->pending_buckets[b] = curr->next;
+            }
+            curr->next = NULL;
+            return curr;
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+    return NULL;
+}
+
+PendingOp* nm_pending_create(const char* filename, PendingCallback on_complete) {
+    PendingOp* op = (PendingOp*)calloc(1, sizeof(PendingOp));
+    if (!op) return NULL;
+    if (filename) strncpy(op->filename, filename, MAX_FILENAME_LEN - 1);
+    op->on_complete = on_complete;
+    op->ss_sock = -1;
+    pthread_cond_init(&op->cond, NULL);
+    return op;
+}
+
+void nm_pending_free(PendingOp* op) {
+    pthread_cond_destroy(&op->cond);
+    free(op);
+}
+
+// Registers 'op' and sends "#<id> <message>" to the SS at ip:port.
+// Returns 0 on success. On failure the op is NOT registered and still belongs
+// to the caller (its callback is not run).
+int nm_send_tracked(NameServer* nm, const char* ip, int client_port, PendingOp* op, const char* message) {
+    int result = -1;
+    strncpy(op->ss_ip, ip, MAX_IP_LEN - 1);
+    op->ss_port = client_port;
+
+    pthread_mutex_lock(&nm->ss_list_mutex);
+    StorageServerInfo* ss = nm->ss_list_head;
+    while (ss && !(strcmp(ss->ip, ip) == 0 && ss->client_port == client_port)) {
+        ss = ss->next;
+    }
+    if (ss) {
+        pthread_mutex_lock(&nm->pending_mutex);
+        op->id = nm->next_request_id++;
+        op->ss_sock = ss->socket;
+        pending_link(nm, op);
+        pthread_mutex_unlock(&nm->pending_mutex);
+
+        char framed[BUFFER_SIZE];
+        snprintf(framed, sizeof(framed), "#%ld %s", op->id, message);
+        result = send_line(ss->socket, framed);
+
+        if (result < 0) {
+            pthread_mutex_lock(&nm->pending_mutex);
+            pending_unlink(nm, op->id);
+            pthread_mutex_unlock(&nm->pending_mutex);
+        }
+    }
+    pthread_mutex_unlock(&nm->ss_list_mutex);
+    return result;
+}
+
+// Blocks until 'op' completes or timeout_sec passes, then frees it.
+// Returns the SS status code (503 on timeout); 'detail' may be NULL.
+int nm_wait_request(NameServer* nm, PendingOp* op, int timeout_sec, char* detail, int detail_size) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_sec;
+
+    pthread_mutex_lock(&nm->pending_mutex);
+    while (!op->done) {
+        if (pthread_cond_timedwait(&op->cond, &nm->pending_mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (!op->done) {
+        pending_unlink(nm, op->id);
+        op->status = ERROR_SS_UNAVAILABLE;
+        strncpy(op->detail, "Storage server did not answer in time.", sizeof(op->detail) - 1);
+    }
+    pthread_mutex_unlock(&nm->pending_mutex);
+
+    int status = op->status;
+    if (detail) {
+        strncpy(detail, op->detail, detail_size - 1);
+        detail[detail_size - 1] = '\0';
+    }
+    nm_pending_free(op);
+    return status;
+}
+
+// Resolves request 'id'. Ops with a callback are completed right here (on the
+// SS listener thread) and freed; otherwise the waiting thread is woken.
+void nm_complete_request(NameServer* nm, long id, int status, const char* detail) {
+    pthread_mutex_lock(&nm->pending_mutex);
+    PendingOp* op = pending_unlink(nm, id);
+    if (!op) {
+        pthread_mutex_unlock(&nm->pending_mutex);
+        return; // Late reply for a request that already timed out
+    }
+    op->status = status;
+    strncpy(op->detail, detail ? detail : "", sizeof(op->detail) - 1);
+
+    if (op->on_complete) {
+        pthread_mutex_unlock(&nm->pending_mutex);
+        op->on_complete(nm, op);
+        nm_pending_free(op);
+        return;
+    }
+    op->done = 1;
+    pthread_cond_signal(&op->cond);
+    pthread_mutex_unlock(&nm->pending_mutex);
+}
+
+// Fails every request still outstanding on an SS connection that just dropped.
+void nm_fail_requests_for_ss(NameServer* nm, int ss_sock) {
+    long ids[256];
+    int n;
+    do {
+        n = 0;
+        pthread_mutex_lock(&nm->pending_mutex);
+        for (int b = 0; b < PENDING_BUCKETS && n < 256; b++) {
+            for (PendingOp* op = nm->pending_buckets[b]; op && n < 256; op = op->next) {
+                if (op->ss_sock == ss_sock) ids[n++] = op->id;
+            }
+        }
+        pthread_mutex_unlock(&nm->pending_mutex);
+        for (int i = 0; i < n; i++) {
+            nm_complete_request(nm, ids[i], ERROR_SS_UNAVAILABLE, "Storage server disconnected.");
+        }
+    } while (n == 256);
+}
+
+// Callback for requests nobody waits on: just log failures.
+void nm_log_request_result(NameServer* nm, PendingOp* op) {
+    if (op->status != MSG_SUCCESS) {
+        char log_buf[BUFFER_SIZE];
+        snprintf(log_buf, sizeof(log_buf), "Request #%ld for '%s' on SS %s:%d failed: %d %s",
+                 op->id, op->filename, op->ss_ip, op->ss_port, op->status, op->detail);
+        log_message("NM", log_buf);
+    }
+}
@@ -54,7 +54,7 @@ void nm_save_files(NameServer* nm) {
             
             pthread_mutex_lock(&meta->lock); // <-- Lock individual file
             
-            // Format: filename|owner|ss_ip|ss_port|access_list|size|words|chars|mod_time
+            // Format: filename|owner|ss_ip|ss_port|access_list|size|words|chars|mod_time|version|replicas
             fprintf(f_files, "%s|%s|%s|%d|", meta->filename, meta->owner, meta->ss_ip, meta->ss_client_port);
             
             AccessNode* anode = meta->access_list_head;
@@ -64,8 +64,15 @@ void nm_save_files(NameServer* nm) {
             }
             
             // --- THIS IS THE NEW PART ---
-            fprintf(f_files, "|%ld|%d|%d|%ld\n", meta->size, meta->word_count, meta->char_count, meta->last_modified);
+            fprintf(f_files, "|%ld|%d|%d|%ld", meta->size, meta->word_count, meta->char_count, meta->last_modified);
             // --- END NEW PART ---
+
+            // Replicas: ip:port:synced_version;...
+            fprintf(f_files, "|%ld|", meta->version);
+            for (int r = 0; r < meta->replica_count; r++) {
+                fprintf(f_files, "%s:%d:%ld;", meta->replicas[r].ip, meta->replicas[r].client_port, meta->replicas[r].synced_version);
+            }
+            fprintf(f_files, "\n");
             
             pthread_mutex_unlock(&meta->lock); // <-- Unlock individual file
             
@@ -182,6 +189,27 @@ void nm_load_files(NameServer* nm) {
         meta->last_modified = atol(parts[8]);
         // --- END NEW PART ---
 
+        // Replication state (absent in files saved by older versions)
+        if (count > 9) {
+            meta->version = atol(parts[9]);
+        }
+        if (count > 10) {
+            int replica_count = 0;
+            char** replica_parts = split_string(parts[10], ";", &replica_count);
+            for (int i = 0; i < replica_count && meta->replica_count < MAX_REPLICAS; i++) {
+                int field_count = 0;
+                char** fields = split_string(replica_parts[i], ":", &field_count);
+                if (field_count == 3) {
+                    ReplicaInfo* r = &meta->replicas[meta->replica_count++];
+                    strncpy(r->ip, fields[0], MAX_IP_LEN - 1);
+                    r->client_port = atoi(fields[1]);
+                    r->synced_version = atol(fields[2]);
+                }
+                free_split_string(fields, field_count);
+            }
+            free_split_string(replica_parts, replica_count);
+        }
+
         // Set remaining times
         meta->created_at = time(NULL); // Or load if saved
         meta->last_accessed = time(NULL); // Always reset on load
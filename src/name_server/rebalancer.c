@@ -0,0 +1,336 @@
+#include "name_server.h"
+#include "persistence.h"
+
+// Load snapshot of one SS for a rebalance pass
+typedef struct {
+    char ip[MAX_IP_LEN];
+    int client_port;
+    long bytes;
+    long requests;
+} SSLoad;
+
+// Counts a routed request against an SS (used for request-rate balancing).
+void nm_note_ss_request(NameServer* nm, const char* ip, int client_port) {
+    pthread_mutex_lock(&nm->ss_list_mutex);
+    StorageServerInfo* ss = nm->ss_list_head;
+    while (ss) {
+        if (strcmp(ss->ip, ip) == 0 && ss->client_port == client_port) {
+            ss->request_count++;
+            break;
+        }
+        ss = ss->next;
+    }
+    pthread_mutex_unlock(&nm->ss_list_mutex);
+}
+
+// --- MIGRATION ---
+
+static int holds_copy(FileMetadata* meta, const char* ip, int port) {
+    if (strcmp(meta->ss_ip, ip) == 0 && meta->ss_client_port == port) return 1;
+    for (int i = 0; i < meta->replica_count; i++) {
+        if (strcmp(meta->replicas[i].ip, ip) == 0 && meta->replicas[i].client_port == port) return 1;
+    }
+    return 0;
+}
+
+// Waits (meta->lock held) until the destination has pulled 'version'.
+// Returns 0 on timeout or if the destination reported a failed pull.
+static int wait_for_dst_sync(NameServer* nm, FileMetadata* meta, long version) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MIGRATE_ACK_TIMEOUT_SEC;
+    while (meta->migration.synced_version < version) {
+        if (meta->migration.synced_version == -2) return 0; // SYNC failed
+        if (pthread_cond_timedwait(&nm->migration_cond, &meta->lock, &deadline) == ETIMEDOUT) return 0;
+    }
+    return 1;
+}
+
+// Waits (meta->lock held) until the source SS has acked FENCE.
+static int wait_for_fence(NameServer* nm, FileMetadata* meta) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MIGRATE_ACK_TIMEOUT_SEC;
+    while (meta->migration.fence != 2) {
+        if (meta->migration.fence == -1) return 0; // FENCE refused or SS gone
+        if (pthread_cond_timedwait(&nm->migration_cond, &meta->lock, &deadline) == ETIMEDOUT) return 0;
+    }
+    return 1;
+}
+
+// Locks 'filename' again after meta->lock was dropped. NULL (and nothing
+// locked) if the entry is gone or is no longer 'meta'.
+static FileMetadata* relock_file(NameServer* nm, const char* filename, FileMetadata* meta) {
+    FileMetadata* now = ht_get_locked(nm->file_table, filename);
+    if (now && now != meta) {
+        pthread_mutex_unlock(&now->lock);
+        now = NULL;
+    }
+    return now;
+}
+
+// Asks the destination to pull the primary's current content. meta->lock is
+// held on entry and dropped for the send; returns the entry locked again
+// (see relock_file()).
+static FileMetadata* request_dst_sync(NameServer* nm, FileMetadata* meta, long rate) {
+    char filename[MAX_FILENAME_LEN];
+    char src_ip[MAX_IP_LEN];
+    char dst_ip[MAX_IP_LEN];
+    strncpy(filename, meta->filename, MAX_FILENAME_LEN);
+    strncpy(src_ip, meta->ss_ip, MAX_IP_LEN);
+    strncpy(dst_ip, meta->migration.dst_ip, MAX_IP_LEN);
+    int src_port = meta->ss_client_port;
+    int dst_port = meta->migration.dst_port;
+    long version = meta->version;
+
+    pthread_mutex_unlock(&meta->lock);
+    int sent = nm_request_sync(nm, filename, dst_ip, dst_port, src_ip, src_port, version, rate);
+    meta = relock_file(nm, filename, meta);
+    if (meta && sent < 0) meta->migration.synced_version = -2;
+    return meta;
+}
+
+// Completion of FENCE on the source SS: its in-flight commit has drained.
+static void on_fence_complete(NameServer* nm, PendingOp* op) {
+    FileMetadata* meta = ht_get_locked(nm->file_table, op->filename);
+    if (!meta) return;
+    if (meta->migration.active && meta->migration.fence == 1) {
+        meta->migration.fence = (op->status == MSG_SUCCESS) ? 2 : -1;
+        pthread_cond_broadcast(&nm->migration_cond);
+    }
+    pthread_mutex_unlock(&meta->lock);
+    nm_log_request_result(nm, op);
+}
+
+// Fire-and-forget control message whose failure is only logged.
+static void send_logged(NameServer* nm, const char* ip, int port, const char* filename, const char* msg) {
+    PendingOp* op = nm_pending_create(filename, nm_log_request_result);
+    if (nm_send_tracked(nm, ip, port, op, msg) < 0) nm_pending_free(op);
+}
+
+// Moves the copy of 'name' held by src to dst:
+//   1. copy phase: dst pulls the file from the primary, throttled
+//   2. catch-up:   repeat while writes keep landing on the primary
+//   3. fence:      refuse new writes and wait for the primary's in-flight commit
+//   4. final pull, then flip the location in FileMetadata under meta->lock
+// The entry is looked up again whenever meta->lock was dropped; a DELETE is
+// refused while the migration is active, so it stays the same entry.
+// Returns 1 if the copy moved, 0 if the migration was abandoned.
+int nm_migrate_file(NameServer* nm, const char* name, const char* src_ip, int src_port, const char* dst_ip, int dst_port) {
+    char log_buf[BUFFER_SIZE];
+    char filename[MAX_FILENAME_LEN];
+    char msg[BUFFER_SIZE];
+
+    FileMetadata* meta = ht_get_locked(nm->file_table, name);
+    if (!meta) return 0;
+    if (meta->migration.active || meta->busy || !holds_copy(meta, src_ip, src_port) || holds_copy(meta, dst_ip, dst_port)) {
+        pthread_mutex_unlock(&meta->lock);
+        return 0;
+    }
+    strncpy(filename, meta->filename, MAX_FILENAME_LEN);
+    int src_is_primary = (strcmp(meta->ss_ip, src_ip) == 0 && meta->ss_client_port == src_port);
+    memset(&meta->migration, 0, sizeof(meta->migration));
+    meta->migration.active = 1;
+    strncpy(meta->migration.dst_ip, dst_ip, MAX_IP_LEN - 1);
+    meta->migration.dst_port = dst_port;
+    meta->migration.synced_version = -1;
+
+    snprintf(log_buf, sizeof(log_buf), "Migrating '%s' (%s) from %s:%d to %s:%d", filename,
+             src_is_primary ? "primary" : "replica", src_ip, src_port, dst_ip, dst_port);
+    log_message("NM-REBAL", log_buf);
+
+    // 1 + 2. Copy and catch up while writes continue on the primary
+    meta = request_dst_sync(nm, meta, MIGRATE_BANDWIDTH_BPS);
+    int ok = meta && wait_for_dst_sync(nm, meta, meta->version);
+    for (int round = 0; ok && round < MIGRATE_CATCHUP_ROUNDS && meta->migration.synced_version < meta->version; round++) {
+        meta = request_dst_sync(nm, meta, MIGRATE_BANDWIDTH_BPS);
+        ok = meta && wait_for_dst_sync(nm, meta, meta->version);
+    }
+
+    // 3 + 4. Brief write fence on the primary, then a final unthrottled pull
+    int fenced = 0;
+    if (ok && src_is_primary) {
+        meta->migration.fence = 1;
+        fenced = 1;
+        snprintf(msg, sizeof(msg), "FENCE %s", filename);
+        pthread_mutex_unlock(&meta->lock);
+        PendingOp* op = nm_pending_create(filename, on_fence_complete);
+        int sent = nm_send_tracked(nm, src_ip, src_port, op, msg);
+        if (sent < 0) nm_pending_free(op);
+        meta = relock_file(nm, filename, meta);
+        ok = meta && (sent == 0) && wait_for_fence(nm, meta);
+        if (ok && meta->migration.synced_version < meta->version) {
+            meta = request_dst_sync(nm, meta, 0);
+            ok = meta && wait_for_dst_sync(nm, meta, meta->version);
+        }
+    } else if (ok && meta->migration.synced_version < meta->version) {
+        ok = 0; // Replica move could not keep up with writes; try again later
+    }
+
+    // The primary may have failed over while we were copying
+    if (ok && src_is_primary != (strcmp(meta->ss_ip, src_ip) == 0 && meta->ss_client_port == src_port)) {
+        ok = 0;
+    }
+
+    // Flip
+    if (ok) {
+        if (src_is_primary) {
+            strncpy(meta->ss_ip, dst_ip, MAX_IP_LEN - 1);
+            meta->ss_client_port = dst_port;
+        } else {
+            for (int i = 0; i < meta->replica_count; i++) {
+                ReplicaInfo* r = &meta->replicas[i];
+                if (strcmp(r->ip, src_ip) == 0 && r->client_port == src_port) {
+                    strncpy(r->ip, dst_ip, MAX_IP_LEN - 1);
+                    r->client_port = dst_port;
+                    r->synced_version = meta->migration.synced_version;
+                    break;
+                }
+            }
+        }
+        nm_revoke_leases(nm, meta, 0);
+    }
+    if (meta) {
+        memset(&meta->migration, 0, sizeof(meta->migration));
+        pthread_mutex_unlock(&meta->lock);
+    }
+
+    // Drop whichever copy is now unreferenced. The old primary is deleted
+    // while still fenced: unfenced, a WRITE session open on it could commit
+    // and be acknowledged just before the DELETE threw the change away.
+    snprintf(msg, sizeof(msg), "DELETE %s", filename);
+    if (ok) {
+        send_logged(nm, src_ip, src_port, filename, msg);
+        nm_save_files(nm);
+        snprintf(log_buf, sizeof(log_buf), "Migration of '%s' to %s:%d complete", filename, dst_ip, dst_port);
+    } else {
+        send_logged(nm, dst_ip, dst_port, filename, msg);
+        if (fenced) {
+            snprintf(msg, sizeof(msg), "UNFENCE %s", filename);
+            send_logged(nm, src_ip, src_port, filename, msg);
+        }
+        snprintf(log_buf, sizeof(log_buf), "Migration of '%s' to %s:%d abandoned", filename, dst_ip, dst_port);
+    }
+    log_message("NM-REBAL", log_buf);
+    return ok;
+}
+
+// --- REBALANCER ---
+
+static int find_load(SSLoad* loads, int n, const char* ip, int port) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(loads[i].ip, ip) == 0 && loads[i].client_port == port) return i;
+    }
+    return -1;
+}
+
+static void nm_rebalance_once(NameServer* nm) {
+    // Snapshot the SS list and start a new request-rate window
+    pthread_mutex_lock(&nm->ss_list_mutex);
+    int n = 0;
+    for (StorageServerInfo* ss = nm->ss_list_head; ss; ss = ss->next) n++;
+    SSLoad* loads = (SSLoad*)calloc(n > 0 ? n : 1, sizeof(SSLoad));
+    int i = 0;
+    for (StorageServerInfo* ss = nm->ss_list_head; ss; ss = ss->next, i++) {
+        strncpy(loads[i].ip, ss->ip, MAX_IP_LEN);
+        loads[i].client_port = ss->client_port;
+        loads[i].requests = ss->request_count;
+        ss->request_count = 0;
+    }
+    pthread_mutex_unlock(&nm->ss_list_mutex);
+
+    // Bytes held per SS, counting every copy. The per-file request counts
+    // start a new window here too, on every pass, like the per-SS ones.
+    pthread_mutex_lock(&nm->file_table->lock);
+    for (int b = 0; b < HT_SIZE; b++) {
+        for (HTNode* node = nm->file_table->buckets[b]; node; node = node->next) {
+            FileMetadata* meta = node->metadata;
+            pthread_mutex_lock(&meta->lock);
+            meta->window_requests = meta->request_count;
+            meta->request_count = 0;
+            int idx = find_load(loads, n, meta->ss_ip, meta->ss_client_port);
+            if (idx >= 0) loads[idx].bytes += meta->size;
+            for (int r = 0; r < meta->replica_count; r++) {
+                idx = find_load(loads, n, meta->replicas[r].ip, meta->replicas[r].client_port);
+                if (idx >= 0) loads[idx].bytes += meta->size;
+            }
+            pthread_mutex_unlock(&meta->lock);
+        }
+    }
+    pthread_mutex_unlock(&nm->file_table->lock);
+
+    if (n < 2) {
+        free(loads);
+        return;
+    }
+
+    // Pick the imbalance to act on: bytes first, then request rate
+    int heavy = 0, light = 0;
+    for (i = 1; i < n; i++) {
+        if (loads[i].bytes > loads[heavy].bytes) heavy = i;
+        if (loads[i].bytes < loads[light].bytes) light = i;
+    }
+    int by_bytes = (loads[heavy].bytes - loads[light].bytes > REBALANCE_MIN_BYTES &&
+                    loads[heavy].bytes > REBALANCE_IMBALANCE_RATIO * loads[light].bytes);
+    if (!by_bytes) {
+        heavy = light = 0;
+        for (i = 1; i < n; i++) {
+            if (loads[i].requests > loads[heavy].requests) heavy = i;
+            if (loads[i].requests < loads[light].requests) light = i;
+        }
+        if (loads[heavy].requests - loads[light].requests <= REBALANCE_MIN_REQUESTS ||
+            loads[heavy].requests <= REBALANCE_IMBALANCE_RATIO * loads[light].requests) {
+            free(loads);
+            return; // Balanced enough
+        }
+    }
+
+    // Candidate: a copy on 'heavy' that 'light' doesn't hold. For bytes, the
+    // largest file that doesn't overshoot; for requests, the hottest file whose
+    // move still narrows the gap (a lone hot file would just bounce back).
+    char best_file[MAX_FILENAME_LEN] = {0};
+    long best_score = -1;
+    long byte_budget = (loads[heavy].bytes - loads[light].bytes) / 2;
+    long request_gap = loads[heavy].requests - loads[light].requests;
+
+    pthread_mutex_lock(&nm->file_table->lock);
+    for (int b = 0; b < HT_SIZE; b++) {
+        for (HTNode* node = nm->file_table->buckets[b]; node; node = node->next) {
+            FileMetadata* meta = node->metadata;
+            pthread_mutex_lock(&meta->lock);
+            if (!meta->migration.active && !meta->busy &&
+                holds_copy(meta, loads[heavy].ip, loads[heavy].client_port) &&
+                !holds_copy(meta, loads[light].ip, loads[light].client_port)) {
+                long score = by_bytes ? (meta->size <= byte_budget ? meta->size : -1)
+                                      : (meta->window_requests < request_gap ? meta->window_requests : -1);
+                if (score > best_score) {
+                    best_score = score;
+                    strncpy(best_file, meta->filename, MAX_FILENAME_LEN - 1);
+                }
+            }
+            pthread_mutex_unlock(&meta->lock);
+        }
+    }
+    pthread_mutex_unlock(&nm->file_table->lock);
+
+    if (best_score > 0) {
+        char log_buf[BUFFER_SIZE];
+        snprintf(log_buf, sizeof(log_buf), "Imbalance by %s: %s:%d (%ld) vs %s:%d (%ld)", by_bytes ? "bytes" : "requests",
+                 loads[heavy].ip, loads[heavy].client_port, by_bytes ? loads[heavy].bytes : loads[heavy].requests,
+                 loads[light].ip, loads[light].client_port, by_bytes ? loads[light].bytes : loads[light].requests);
+        log_message("NM-REBAL", log_buf);
+
+        nm_migrate_file(nm, best_file, loads[heavy].ip, loads[heavy].client_port, loads[light].ip, loads[light].client_port);
+    }
+    free(loads);
+}
+
+// Background thread: one migration per pass, at most every REBALANCE_INTERVAL_SEC.
+void* nm_rebalancer_thread(void* arg) {
+    NameServer* nm = (NameServer*)arg;
+    while (1) {
+        sleep(REBALANCE_INTERVAL_SEC);
+        nm_rebalance_once(nm);
+    }
+    return NULL;
+}
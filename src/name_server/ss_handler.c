@@ -2,7 +2,7 @@
 #include "persistence.h"
 
 void add_ss(NameServer* nm, int sock, const char* ip, int client_port) {
-    StorageServerInfo* new_ss = (StorageServerInfo*)malloc(sizeof(StorageServerInfo));
+    StorageServerInfo* new_ss = (StorageServerInfo*)calloc(1, sizeof(StorageServerInfo));
     new_ss->socket = sock;
     strncpy(new_ss->ip, ip, MAX_IP_LEN - 1);
     new_ss->client_port = client_port;
@@ -41,20 +41,24 @@ void remove_ss(NameServer* nm, int sock) {
     }
     pthread_mutex_unlock(&nm->ss_list_mutex);
 
+    nm_fail_requests_for_ss(nm, sock);
+
     if (port > 0) {
         char log_buf[BUFFER_SIZE];
-        snprintf(log_buf, sizeof(log_buf), "Storage Server disconnected: %s:%d. Files are now offline.", ip, port);
+        snprintf(log_buf, sizeof(log_buf), "Storage Server disconnected: %s:%d. Failing over its files.", ip, port);
         log_message("NM", log_buf);
-        // Note: A fault-tolerant system would now mark all files
-        // from this SS as 'unavailable' or failover to a replica.
+        nm_failover_ss(nm, ip, port);
     }
 }
 
-StorageServerInfo* get_ss_for_new_file(NameServer* nm) {
+// Picks up to 'max_count' distinct storage servers (round-robin) and copies
+// them into 'out'. The first one is meant to be the primary.
+// Returns the number of servers picked (0 if none are connected).
+int get_ss_for_new_file(NameServer* nm, StorageServerInfo* out, int max_count) {
     pthread_mutex_lock(&nm->ss_list_mutex);
     if (!nm->ss_list_head) {
         pthread_mutex_unlock(&nm->ss_list_mutex);
-        return NULL; // No SS available
+        return 0; // No SS available
     }
     
     // Simple round-robin
@@ -69,15 +73,342 @@ StorageServerInfo* get_ss_for_new_file(NameServer* nm) {
         nm->next_ss_index = 0;
     }
     
-    curr = nm->ss_list_head;
-    for (int i = 0; i < nm->next_ss_index; i++) {
-        curr = curr->next;
+    int picked = 0;
+    for (int i = 0; i < count && picked < max_count; i++) {
+        int target = (nm->next_ss_index + i) % count;
+        curr = nm->ss_list_head;
+        for (int j = 0; j < target; j++) {
+            curr = curr->next;
+        }
+        out[picked] = *curr;
+        out[picked].next = NULL;
+        picked++;
     }
     
     nm->next_ss_index++;
     pthread_mutex_unlock(&nm->ss_list_mutex);
     
-    return curr;
+    return picked;
+}
+
+int is_ss_online(NameServer* nm, const char* ip, int client_port) {
+    int online = 0;
+    pthread_mutex_lock(&nm->ss_list_mutex);
+    StorageServerInfo* ss = nm->ss_list_head;
+    while (ss) {
+        if (strcmp(ss->ip, ip) == 0 && ss->client_port == client_port) {
+            online = 1;
+            break;
+        }
+        ss = ss->next;
+    }
+    pthread_mutex_unlock(&nm->ss_list_mutex);
+    return online;
+}
+
+// Sends a control message to an SS. The list mutex is held across the send
+// so concurrent senders never interleave and the SS can't be freed under us.
+// Returns 0 on success, -1 if the SS is offline or the send failed.
+int nm_send_to_ss(NameServer* nm, const char* ip, int client_port, const char* message) {
+    int result = -1;
+    pthread_mutex_lock(&nm->ss_list_mutex);
+    StorageServerInfo* ss = nm->ss_list_head;
+    while (ss) {
+        if (strcmp(ss->ip, ip) == 0 && ss->client_port == client_port) {
+            result = send_line(ss->socket, message);
+            break;
+        }
+        ss = ss->next;
+    }
+    pthread_mutex_unlock(&nm->ss_list_mutex);
+    return result;
+}
+
+// --- REPLICATION ---
+
+// Completion of a SYNC: advances a replica's synced version, or reports
+// progress to a migration waiting in rebalancer.c.
+static void on_sync_complete(NameServer* nm, PendingOp* op) {
+    FileMetadata* meta = ht_get_locked(nm->file_table, op->filename);
+    if (!meta) return;
+    int ok = (op->status == MSG_SUCCESS);
+    int replica_moved = 0;
+
+    MigrationState* mig = &meta->migration;
+    if (mig->active && strcmp(mig->dst_ip, op->ss_ip) == 0 && mig->dst_port == op->ss_port) {
+        if (!ok) {
+            mig->synced_version = -2;
+        } else if (op->version > mig->synced_version) {
+            mig->synced_version = op->version;
+        }
+        pthread_cond_broadcast(&nm->migration_cond);
+    } else if (ok) {
+        for (int i = 0; i < meta->replica_count; i++) {
+            ReplicaInfo* r = &meta->replicas[i];
+            if (strcmp(r->ip, op->ss_ip) == 0 && r->client_port == op->ss_port) {
+                if (op->version > r->synced_version) r->synced_version = op->version;
+                replica_moved = 1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&meta->lock);
+
+    if (!ok) nm_log_request_result(nm, op);
+    if (replica_moved) nm_save_files(nm);
+}
+
+// Asks dst to pull 'filename' at 'version' from src (rate_bps 0 = unthrottled).
+// Completion is handled asynchronously by on_sync_complete.
+int nm_request_sync(NameServer* nm, const char* filename, const char* dst_ip, int dst_port,
+                    const char* src_ip, int src_port, long version, long rate_bps) {
+    char msg[BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "SYNC %s %s %d %ld %ld", filename, src_ip, src_port, version, rate_bps);
+    PendingOp* op = nm_pending_create(filename, on_sync_complete);
+    op->version = version;
+    if (nm_send_tracked(nm, dst_ip, dst_port, op, msg) < 0) {
+        nm_pending_free(op);
+        return -1;
+    }
+    return 0;
+}
+
+// Tells every replica that is behind the primary to pull the current version.
+void nm_replicate_file(NameServer* nm, FileMetadata* meta) {
+    char filename[MAX_FILENAME_LEN];
+    char src_ip[MAX_IP_LEN];
+    int src_port;
+    long version;
+    char ips[MAX_REPLICAS][MAX_IP_LEN];
+    int ports[MAX_REPLICAS];
+    int n = 0;
+
+    pthread_mutex_lock(&meta->lock);
+    strncpy(filename, meta->filename, MAX_FILENAME_LEN);
+    strncpy(src_ip, meta->ss_ip, MAX_IP_LEN);
+    src_port = meta->ss_client_port;
+    version = meta->version;
+    for (int i = 0; i < meta->replica_count; i++) {
+        ReplicaInfo* r = &meta->replicas[i];
+        if (r->synced_version >= meta->version) continue;
+        strncpy(ips[n], r->ip, MAX_IP_LEN);
+        ports[n] = r->client_port;
+        n++;
+    }
+    pthread_mutex_unlock(&meta->lock);
+
+    for (int i = 0; i < n; i++) {
+        if (nm_request_sync(nm, filename, ips[i], ports[i], src_ip, src_port, version, 0) < 0) {
+            char log_buf[BUFFER_SIZE];
+            snprintf(log_buf, sizeof(log_buf), "Replica %s:%d is offline; it will resync when it reconnects.", ips[i], ports[i]);
+            log_message("NM", log_buf);
+        }
+    }
+}
+
+// Chooses where a READ/STREAM should go: the primary or any in-sync replica,
+// round-robin. Returns 1 and fills ip/port on success, 0 if no copy is online.
+int nm_pick_read_location(NameServer* nm, FileMetadata* meta, char* ip, int* client_port) {
+    char cand_ips[MAX_REPLICAS + 1][MAX_IP_LEN];
+    int cand_ports[MAX_REPLICAS + 1];
+    int n = 0;
+
+    pthread_mutex_lock(&meta->lock);
+    if (is_ss_online(nm, meta->ss_ip, meta->ss_client_port)) {
+        strncpy(cand_ips[n], meta->ss_ip, MAX_IP_LEN);
+        cand_ports[n++] = meta->ss_client_port;
+    }
+    for (int i = 0; i < meta->replica_count; i++) {
+        ReplicaInfo* r = &meta->replicas[i];
+        if (r->synced_version == meta->version && is_ss_online(nm, r->ip, r->client_port)) {
+            strncpy(cand_ips[n], r->ip, MAX_IP_LEN);
+            cand_ports[n++] = r->client_port;
+        }
+    }
+    if (n > 0) {
+        int pick = meta->read_cursor++ % n;
+        strncpy(ip, cand_ips[pick], MAX_IP_LEN);
+        *client_port = cand_ports[pick];
+    }
+    pthread_mutex_unlock(&meta->lock);
+    return n > 0;
+}
+
+// Swaps the primary with replica 'idx'. The old primary stays on as a replica
+// that was current at the time of the swap. Caller holds meta->lock.
+static void promote_replica(NameServer* nm, FileMetadata* meta, int idx) {
+    ReplicaInfo old_primary;
+    strncpy(old_primary.ip, meta->ss_ip, MAX_IP_LEN);
+    old_primary.client_port = meta->ss_client_port;
+    old_primary.synced_version = meta->version;
+
+    strncpy(meta->ss_ip, meta->replicas[idx].ip, MAX_IP_LEN);
+    meta->ss_client_port = meta->replicas[idx].client_port;
+    meta->replicas[idx] = old_primary;
+    nm_revoke_leases(nm, meta, 0);
+}
+
+// Called after an SS drops: every file whose primary lived there is moved to
+// an online, in-sync replica if one exists.
+void nm_failover_ss(NameServer* nm, const char* ip, int client_port) {
+    int promoted = 0;
+    int offline = 0;
+    char log_buf[BUFFER_SIZE];
+
+    pthread_mutex_lock(&nm->file_table->lock);
+    for (int i = 0; i < HT_SIZE; i++) {
+        for (HTNode* node = nm->file_table->buckets[i]; node; node = node->next) {
+            FileMetadata* meta = node->metadata;
+            pthread_mutex_lock(&meta->lock);
+            if (strcmp(meta->ss_ip, ip) == 0 && meta->ss_client_port == client_port) {
+                int target = -1;
+                for (int r = 0; r < meta->replica_count; r++) {
+                    ReplicaInfo* rep = &meta->replicas[r];
+                    if (rep->synced_version == meta->version && is_ss_online(nm, rep->ip, rep->client_port)) {
+                        target = r;
+                        break;
+                    }
+                }
+                if (target >= 0) {
+                    promote_replica(nm, meta, target);
+                    promoted++;
+                    snprintf(log_buf, sizeof(log_buf), "File '%s' failed over to replica %s:%d", meta->filename, meta->ss_ip, meta->ss_client_port);
+                    log_message("NM", log_buf);
+                } else {
+                    offline++;
+                }
+            }
+            pthread_mutex_unlock(&meta->lock);
+        }
+    }
+    pthread_mutex_unlock(&nm->file_table->lock);
+
+    if (offline > 0) {
+        snprintf(log_buf, sizeof(log_buf), "%d file(s) from %s:%d have no in-sync replica and are now offline.", offline, ip, client_port);
+        log_message("NM", log_buf);
+    }
+    if (promoted > 0) {
+        nm_save_files(nm);
+    }
+}
+
+// One entry of a MANIFEST chunk: <name>:<size>:<words>:<chars>:<mtime>
+typedef struct {
+    char* name;
+    long size;
+    int words;
+    int chars;
+    time_t mtime;
+} ReportedFile;
+
+// Parses 'entry' in place, reading fields from the right so names may hold ':'.
+static int parse_manifest_entry(char* entry, ReportedFile* out) {
+    char* fields[4];
+    for (int i = 3; i >= 0; i--) {
+        char* sep = strrchr(entry, ':');
+        if (!sep) return 0;
+        *sep = '\0';
+        fields[i] = sep + 1;
+    }
+    if (entry[0] == '\0') return 0;
+    out->name = entry;
+    out->size = atol(fields[0]);
+    out->words = atoi(fields[1]);
+    out->chars = atoi(fields[2]);
+    out->mtime = (time_t)atol(fields[3]);
+    return 1;
+}
+
+// Decides what a (re)connecting SS is for a file it reports, and kicks off a
+// resync if its copy is behind. If the SS ends up as the primary, its stats
+// become the file's stats. Returns 1 if the metadata changed.
+static int reconcile_reported_file(NameServer* nm, FileMetadata* meta, const ReportedFile* rf, const char* ss_ip, int client_port) {
+    int need_sync = 0;
+    int changed = 0;
+    char log_buf[BUFFER_SIZE];
+    log_buf[0] = '\0';
+
+    pthread_mutex_lock(&meta->lock);
+    if (!(strcmp(meta->ss_ip, ss_ip) == 0 && meta->ss_client_port == client_port)) {
+        int idx = -1;
+        for (int i = 0; i < meta->replica_count; i++) {
+            if (strcmp(meta->replicas[i].ip, ss_ip) == 0 && meta->replicas[i].client_port == client_port) {
+                idx = i;
+                break;
+            }
+        }
+        int primary_online = is_ss_online(nm, meta->ss_ip, meta->ss_client_port);
+
+        if (idx >= 0 && !primary_online && meta->replicas[idx].synced_version == meta->version) {
+            promote_replica(nm, meta, idx);
+            changed = 1;
+            snprintf(log_buf, sizeof(log_buf), "File '%s' primary offline; promoted returning replica %s:%d", meta->filename, ss_ip, client_port);
+        } else if (idx >= 0) {
+            need_sync = primary_online && meta->replicas[idx].synced_version < meta->version;
+            if (need_sync) {
+                snprintf(log_buf, sizeof(log_buf), "Replica of '%s' is back on SS %s:%d (resyncing)", meta->filename, ss_ip, client_port);
+            }
+        } else if (!primary_online) {
+            // Unknown copy and nothing better online: adopt it as the primary.
+            strncpy(meta->ss_ip, ss_ip, MAX_IP_LEN - 1);
+            meta->ss_client_port = client_port;
+            nm_revoke_leases(nm, meta, 0);
+            changed = 1;
+            snprintf(log_buf, sizeof(log_buf), "File '%s' adopted from SS %s:%d as primary", meta->filename, ss_ip, client_port);
+        } else if (meta->replica_count < nm->replication_factor - 1 && meta->replica_count < MAX_REPLICAS) {
+            ReplicaInfo* r = &meta->replicas[meta->replica_count++];
+            strncpy(r->ip, ss_ip, MAX_IP_LEN - 1);
+            r->client_port = client_port;
+            r->synced_version = -1;
+            need_sync = 1;
+            changed = 1;
+            snprintf(log_buf, sizeof(log_buf), "Adopted SS %s:%d as a new replica of '%s'", ss_ip, client_port, meta->filename);
+        } else {
+            snprintf(log_buf, sizeof(log_buf), "SS %s:%d holds an extra copy of '%s'. Ignoring.", ss_ip, client_port, meta->filename);
+        }
+    }
+
+    // The primary's copy is the truth for size and counts
+    if (strcmp(meta->ss_ip, ss_ip) == 0 && meta->ss_client_port == client_port &&
+        (meta->size != rf->size || meta->word_count != rf->words || meta->char_count != rf->chars ||
+         meta->last_modified != rf->mtime)) {
+        if (meta->size != rf->size || meta->word_count != rf->words) {
+            // Content changed while we weren't looking; replicas are now behind
+            meta->version++;
+            need_sync = meta->replica_count > 0;
+        }
+        meta->size = rf->size;
+        meta->word_count = rf->words;
+        meta->char_count = rf->chars;
+        meta->last_modified = rf->mtime;
+        changed = 1;
+    }
+    pthread_mutex_unlock(&meta->lock);
+    if (log_buf[0]) log_message("NM", log_buf);
+
+    if (need_sync) {
+        nm_replicate_file(nm, meta);
+    }
+    return changed;
+}
+
+// Reconciles one MANIFEST chunk. Counters accumulate across chunks.
+static void reconcile_manifest_chunk(NameServer* nm, char* entries, const char* ss_ip, int client_port,
+                                     int* known, int* orphans, int* changed) {
+    char* saveptr = NULL;
+    for (char* entry = strtok_r(entries, "/", &saveptr); entry; entry = strtok_r(NULL, "/", &saveptr)) {
+        ReportedFile rf;
+        if (!parse_manifest_entry(entry, &rf)) continue;
+        FileMetadata* meta = ht_get(nm->file_table, rf.name);
+        if (meta) {
+            (*known)++;
+            *changed += reconcile_reported_file(nm, meta, &rf, ss_ip, client_port);
+        } else {
+            // The SS has a file the NM doesn't know about (e.g. NM lost its
+            // state). Without an owner we can't register it, so it's ignored.
+            (*orphans)++;
+        }
+    }
 }
 
 void* nm_handle_ss_init(void* arg) {
@@ -85,9 +416,12 @@ void* nm_handle_ss_init(void* arg) {
     NameServer* nm = args->nm;
     int ss_sock = args->sock;
     char* ss_ip = args->ip;
+    char log_buf[BUFFER_SIZE];
     
+    LineReader reader;
+    line_reader_init(&reader, ss_sock);
     char buffer[BUFFER_SIZE];
-    int bytes_read = recv_message(ss_sock, buffer);
+    int bytes_read = recv_line(&reader, buffer, sizeof(buffer));
     if (bytes_read <= 0) {
         log_message("NM", "SS failed to send INIT or disconnected.");
         close(ss_sock);
@@ -95,11 +429,11 @@ void* nm_handle_ss_init(void* arg) {
         return NULL;
     }
 
-    // Expected: INIT_SS <client_port> [file1,file2,file3]
+    // Expected: INIT_SS <client_port>, then MANIFEST chunks and MANIFEST_END <count>
     int count = 0;
     char** parts = split_string(buffer, " ", &count);
     
-    if (count < 3 || strcmp(parts[0], "INIT_SS") != 0) {
+    if (count != 2 || strcmp(parts[0], "INIT_SS") != 0) {
         log_message("NM", "Invalid INIT_SS message.");
         send_message(ss_sock, "400 ERROR: Invalid INIT_SS");
         close(ss_sock);
@@ -109,50 +443,42 @@ void* nm_handle_ss_init(void* arg) {
     }
     
     int client_port = atoi(parts[1]);
+    free_split_string(parts, count);
     add_ss(nm, ss_sock, ss_ip, client_port);
-    
-    // Parse file list: [file1,file2,file3]
-    char* file_list_str = parts[2];
-    file_list_str[strlen(file_list_str) - 1] = '\0'; // Remove ']'
-    file_list_str++; // Skip '['
-
-    if (strlen(file_list_str) > 0) {
-        int file_count = 0;
-        char** files = split_string(file_list_str, ",", &file_count);
-        for (int i = 0; i < file_count; i++) {
-            FileMetadata* meta = ht_get(nm->file_table, files[i]);
-            if (meta) {
-                // File exists, update its location (SS reconnected)
-                pthread_mutex_lock(&meta->lock);
-                strncpy(meta->ss_ip, ss_ip, MAX_IP_LEN - 1);
-                meta->ss_client_port = client_port;
-                // TODO: Update file size/stats
-                pthread_mutex_unlock(&meta->lock);
-                
-                char log_buf[BUFFER_SIZE];
-                snprintf(log_buf, sizeof(log_buf), "File '%s' is back online on SS %s:%d", files[i], ss_ip, client_port);
-                log_message("NM", log_buf);
-            } else {
-                // This SS has a file the NM doesn't know about
-                // (e.g., NM crashed and lost state, but SS didn't)
-                // We should add it, but who is the owner?
-                // For now, we'll log it.
-                // A better system would have the SS send owner info.
-                char log_buf[BUFFER_SIZE];
-                snprintf(log_buf, sizeof(log_buf), "SS %s:%d reported orphan file '%s'. Ignoring.", ss_ip, client_port, files[i]);
-                log_message("NM", log_buf);
-            }
+
+    // Reconcile the manifest chunk by chunk as it streams in
+    int known = 0, orphans = 0, changed = 0, reported = -1;
+    while (recv_line(&reader, buffer, sizeof(buffer)) > 0) {
+        if (strncmp(buffer, "MANIFEST ", 9) == 0) {
+            reconcile_manifest_chunk(nm, buffer + 9, ss_ip, client_port, &known, &orphans, &changed);
+        } else if (strncmp(buffer, "MANIFEST_END", 12) == 0) {
+            reported = atoi(buffer + 12);
+            break;
         }
-        free_split_string(files, file_count);
     }
-    
-    free_split_string(parts, count);
+    if (reported < 0) {
+        log_message("NM", "SS disconnected during registration.");
+        remove_ss(nm, ss_sock);
+        close(ss_sock);
+        free(arg);
+        return NULL;
+    }
+    if (changed > 0) {
+        nm_save_files(nm);
+    }
+    snprintf(log_buf, sizeof(log_buf), "SS %s:%d registered %d file(s): %d known, %d orphan(s) ignored, %d updated",
+             ss_ip, client_port, reported, known, orphans, changed);
+    log_message("NM", log_buf);
     
     // Spawn the message listener thread for this SS
     pthread_t tid;
     NM_SSMsgArgs* msg_args = (NM_SSMsgArgs*)malloc(sizeof(NM_SSMsgArgs));
     msg_args->nm = nm;
     msg_args->ss_sock = ss_sock;
+    strncpy(msg_args->ss_ip, ss_ip, MAX_IP_LEN - 1);
+    msg_args->ss_ip[MAX_IP_LEN - 1] = '\0';
+    msg_args->ss_client_port = client_port;
+    msg_args->reader = reader;
     pthread_create(&tid, NULL, nm_handle_ss_messages, msg_args);
     pthread_detach(tid);
     
@@ -161,16 +487,17 @@ void* nm_handle_ss_init(void* arg) {
 }
 
 
-// Runs in its own thread, listening for ACKs from a single SS
+// Runs in its own thread, listening for ACKs from a single SS.
+// Replies are matched to requests by id, so this never blocks on a client.
 void* nm_handle_ss_messages(void* arg) {
     NM_SSMsgArgs* args = (NM_SSMsgArgs*)arg;
     NameServer* nm = args->nm;
     int ss_sock = args->ss_sock;
     
     char buffer[BUFFER_SIZE];
-    while (recv_message(ss_sock, buffer) > 0) {
-        // SS sends ACKs like: "ACK_CREATE <file>" or "ACK_DELETE <file>"
-        // Or file info: "INFO_UPDATE <file> <size> <words> <chars>"
+    while (recv_line(&args->reader, buffer, sizeof(buffer)) > 0) {
+        // SS answers tracked requests with "ACK #<id> <status> [detail]"
+        // and pushes file info after commits: "INFO_UPDATE <file> <size> <words> <chars>"
         
         char log_buf[BUFFER_SIZE];
         snprintf(log_buf, sizeof(log_buf), "Received from SS (sock %d): %s", ss_sock, buffer);
@@ -187,22 +514,37 @@ void* nm_handle_ss_messages(void* arg) {
             const char* filename = parts[1];
             FileMetadata* meta = ht_get(nm->file_table, filename);
             if (meta) {
+                int from_primary = 0;
                 pthread_mutex_lock(&meta->lock);
-                meta->size = atol(parts[2]);
-                meta->word_count = atoi(parts[3]);
-                meta->char_count = atoi(parts[4]);
-                meta->last_modified = time(NULL);
+                if (strcmp(meta->ss_ip, args->ss_ip) == 0 && meta->ss_client_port == args->ss_client_port) {
+                    from_primary = 1;
+                    meta->size = atol(parts[2]);
+                    meta->word_count = atoi(parts[3]);
+                    meta->char_count = atoi(parts[4]);
+                    meta->last_modified = time(NULL);
+                    meta->version++;
+                    nm_revoke_leases(nm, meta, 1); // Replicas are behind until they resync
+                }
                 pthread_mutex_unlock(&meta->lock);
 
-
-                nm_save_files(nm);
+                if (from_primary) {
+                    nm_replicate_file(nm, meta);
+                    nm_save_files(nm);
+                } else {
+                    snprintf(log_buf, sizeof(log_buf), "Ignoring INFO_UPDATE for '%s' from non-primary SS %s:%d", filename, args->ss_ip, args->ss_client_port);
+                    log_message("NM", log_buf);
+                }
+            }
+        } else if (strcmp(parts[0], "ACK") == 0 && count >= 3 && parts[1][0] == '#') {
+            // ACK #<id> <status> [detail...]
+            const char* detail = buffer;
+            for (int field = 0; field < 3; field++) {
+                while (*detail == ' ') detail++;
+                while (*detail && *detail != ' ') detail++;
             }
+            while (*detail == ' ') detail++;
+            nm_complete_request(nm, atol(parts[1] + 1), atoi(parts[2]), detail);
         }
-        // Other ACKs are handled... but for this design, the
-        // client_handler blocks waiting for the ACK, so this
-        // thread is mostly for async updates like file stats.
-        // We'll have the SS send INFO_UPDATE after every WRITE.
-
         free_split_string(parts, count);
     }
     
@@ -0,0 +1,232 @@
+#include "content_cache.h"
+#include "persistence.h"
+#include "segment_store.h"
+
+static unsigned long long cache_hash(const char* filename) {
+    unsigned long long hash = 1469598103934665603ULL;
+    while (*filename) {
+        hash ^= (unsigned char)*filename++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static CacheShard* cache_shard(ContentCache* cache, unsigned long long hash) {
+    return &cache->shards[hash % CONTENT_CACHE_SHARDS];
+}
+
+// --- TinyLFU frequency sketch (caller holds the shard lock) ---
+
+static int sketch_slot(unsigned long long hash, int row) {
+    unsigned long long step = (hash >> 17) | 1;
+    return (int)((hash + row * step) % CACHE_SKETCH_WIDTH);
+}
+
+static void sketch_record(CacheShard* shard, unsigned long long hash) {
+    for (int row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+        unsigned char* counter = &shard->sketch[row][sketch_slot(hash, row)];
+        if (*counter < 255) (*counter)++;
+    }
+    // Halve everything now and then so old popularity fades
+    if (++shard->sketch_events >= CACHE_SKETCH_RESET) {
+        for (int row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+            for (int i = 0; i < CACHE_SKETCH_WIDTH; i++) shard->sketch[row][i] >>= 1;
+        }
+        shard->sketch_events = 0;
+    }
+}
+
+static int sketch_estimate(CacheShard* shard, unsigned long long hash) {
+    int estimate = 255;
+    for (int row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+        int count = shard->sketch[row][sketch_slot(hash, row)];
+        if (count < estimate) estimate = count;
+    }
+    return estimate;
+}
+
+// --- Shard table + LRU list (caller holds the shard lock) ---
+
+static CacheEntry* shard_find(CacheShard* shard, const char* filename, unsigned long long hash) {
+    CacheEntry* e = shard->buckets[(hash / CONTENT_CACHE_SHARDS) % CONTENT_CACHE_BUCKETS];
+    while (e && strcmp(e->filename, filename) != 0) e = e->next;
+    return e;
+}
+
+static void lru_unlink(CacheShard* shard, CacheEntry* e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next; else shard->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev; else shard->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(CacheShard* shard, CacheEntry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head) shard->lru_head->lru_prev = e;
+    shard->lru_head = e;
+    if (!shard->lru_tail) shard->lru_tail = e;
+}
+
+static void shard_remove(CacheShard* shard, CacheEntry* e) {
+    CacheEntry** link = &shard->buckets[(e->hash / CONTENT_CACHE_SHARDS) % CONTENT_CACHE_BUCKETS];
+    while (*link != e) link = &(*link)->next;
+    *link = e->next;
+    lru_unlink(shard, e);
+    shard->bytes -= e->content->len;
+    atomic_fetch_sub(shard->total, e->content->len);
+    content_cache_release(e->content);
+    free(e->filename);
+    free(e);
+}
+
+// Adds 'content' under 'filename' if TinyLFU admits it; a newer version of a
+// file already cached takes its place without asking. The cache takes its own
+// reference; the caller keeps theirs.
+static void shard_insert(ContentCache* cache, CacheShard* shard, const char* filename, unsigned long long hash,
+                         CachedContent* content) {
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry* existing = shard_find(shard, filename, hash);
+    if (existing) {
+        if (existing->content->version >= content->version) {
+            pthread_mutex_unlock(&shard->lock); // Someone already cached this or newer
+            return;
+        }
+        shard_remove(shard, existing);
+    }
+    int replacing = existing != NULL;
+    if (content->len > cache->max_entry) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    // An entry bigger than the shard's slice has to displace the rest of the
+    // shard, and the cache as a whole stays within its budget
+    long limit = content->len > shard->budget ? content->len : shard->budget;
+    int frequency = sketch_estimate(shard, hash);
+    while (shard->bytes + content->len > limit || atomic_load(shard->total) + content->len > cache->budget) {
+        CacheEntry* victim = shard->lru_tail;
+        if (!victim || (!replacing && sketch_estimate(shard, victim->hash) >= frequency)) {
+            pthread_mutex_unlock(&shard->lock); // Not popular enough to displace it
+            return;
+        }
+        shard_remove(shard, victim);
+    }
+
+    CacheEntry* e = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    e->filename = strdup(filename);
+    e->hash = hash;
+    e->content = content;
+    atomic_fetch_add(&content->refs, 1);
+    int b = (hash / CONTENT_CACHE_SHARDS) % CONTENT_CACHE_BUCKETS;
+    e->next = shard->buckets[b];
+    shard->buckets[b] = e;
+    lru_push_front(shard, e);
+    shard->bytes += content->len;
+    atomic_fetch_add(shard->total, content->len);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static CachedContent* content_alloc(long len, long version) {
+    CachedContent* content = (CachedContent*)malloc(sizeof(CachedContent) + len + 1);
+    if (!content) return NULL;
+    atomic_init(&content->refs, 1);
+    content->version = version;
+    content->len = len;
+    content->data[len] = '\0';
+    return content;
+}
+
+CachedContent* content_cache_read_view(FileView* view) {
+    CachedContent* content = content_alloc(view->size, view->version);
+    if (content) {
+        content->len = ss_view_read(view, content->data, view->size, 0);
+        content->data[content->len] = '\0';
+    }
+    return content;
+}
+
+// The version tag comes from the same open file as the bytes, so a commit
+// racing with the load can't pair new bytes with an old version.
+static CachedContent* content_load(StorageServer* ss, const char* filename) {
+    FileView view;
+    if (ss_open_view(ss, filename, &view) < 0) return NULL;
+    CachedContent* content = content_cache_read_view(&view);
+    ss_view_close(&view);
+    return content;
+}
+
+ContentCache* content_cache_create(long budget_bytes, long max_entry_bytes) {
+    if (budget_bytes <= 0) return NULL;
+    ContentCache* cache = (ContentCache*)calloc(1, sizeof(ContentCache));
+    if (!cache) return NULL;
+    atomic_init(&cache->bytes, 0);
+    cache->budget = budget_bytes;
+    cache->max_entry = max_entry_bytes > 0 ? max_entry_bytes : budget_bytes / 4;
+    if (cache->max_entry > budget_bytes) cache->max_entry = budget_bytes;
+    for (int i = 0; i < CONTENT_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+        cache->shards[i].budget = budget_bytes / CONTENT_CACHE_SHARDS;
+        cache->shards[i].total = &cache->bytes;
+    }
+    return cache;
+}
+
+CachedContent* content_cache_get(StorageServer* ss, const char* filename) {
+    ContentCache* cache = ss->content_cache;
+    long version = ss_manifest_version(ss, filename);
+    unsigned long long hash = cache_hash(filename);
+    CacheShard* shard = cache ? cache_shard(cache, hash) : NULL;
+
+    if (shard && version >= 0) {
+        pthread_mutex_lock(&shard->lock);
+        sketch_record(shard, hash);
+        CacheEntry* e = shard_find(shard, filename, hash);
+        if (e && e->content->version == version) {
+            lru_unlink(shard, e);
+            lru_push_front(shard, e);
+            CachedContent* hit = e->content;
+            atomic_fetch_add(&hit->refs, 1);
+            pthread_mutex_unlock(&shard->lock);
+            return hit;
+        }
+        if (e) shard_remove(shard, e);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    CachedContent* content = content_load(ss, filename);
+    if (content && shard && content->version >= 0) {
+        shard_insert(cache, shard, filename, hash, content);
+    }
+    return content;
+}
+
+void content_cache_put(StorageServer* ss, const char* filename, const char* data, long len, long version) {
+    ContentCache* cache = ss->content_cache;
+    if (!cache) return;
+    unsigned long long hash = cache_hash(filename);
+    CacheShard* shard = cache_shard(cache, hash);
+    CachedContent* content = content_alloc(len, version);
+    if (!content) return;
+    memcpy(content->data, data, len);
+    pthread_mutex_lock(&shard->lock);
+    sketch_record(shard, hash);
+    pthread_mutex_unlock(&shard->lock);
+    shard_insert(cache, shard, filename, hash, content);
+    content_cache_release(content);
+}
+
+void content_cache_invalidate(StorageServer* ss, const char* filename) {
+    ContentCache* cache = ss->content_cache;
+    if (!cache) return;
+    unsigned long long hash = cache_hash(filename);
+    CacheShard* shard = cache_shard(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry* e = shard_find(shard, filename, hash);
+    if (e) shard_remove(shard, e);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void content_cache_release(CachedContent* content) {
+    if (content && atomic_fetch_sub(&content->refs, 1) == 1) {
+        free(content);
+    }
+}
@@ -0,0 +1,232 @@
+#include "document.h"
+#include "file_parser.h"
+
+static void doc_reserve(Document* doc, int needed) {
+    if (needed <= doc->capacity) return;
+    while (doc->capacity < needed) doc->capacity = doc->capacity ? doc->capacity * 2 : 16;
+    doc->pieces = (DocPiece*)realloc(doc->pieces, doc->capacity * sizeof(DocPiece));
+}
+
+static const char* doc_own(Document* doc, char* buffer) {
+    if (doc->owned_count == doc->owned_capacity) {
+        doc->owned_capacity = doc->owned_capacity ? doc->owned_capacity * 2 : 16;
+        doc->owned = (char**)realloc(doc->owned, doc->owned_capacity * sizeof(char*));
+    }
+    doc->owned[doc->owned_count++] = buffer;
+    return buffer;
+}
+
+// Replaces pieces [lo, hi) with 'n' new ones from 'texts' (taken over).
+static void doc_splice(Document* doc, int lo, int hi, char** texts, int n) {
+    doc_reserve(doc, doc->count - (hi - lo) + n);
+    memmove(&doc->pieces[lo + n], &doc->pieces[hi], (doc->count - hi) * sizeof(DocPiece));
+    for (int i = 0; i < n; i++) {
+        doc->pieces[lo + i].text = doc_own(doc, texts[i]);
+        doc->pieces[lo + i].len = strlen(texts[i]);
+        doc->pieces[lo + i].words = count_words(texts[i], doc->pieces[lo + i].len);
+    }
+    doc->count += n - (hi - lo);
+}
+
+// Last non-space character of 'text', or 0 if there is none.
+static char last_visible(const char* text, long len) {
+    while (len > 0 && isspace((unsigned char)text[len - 1])) len--;
+    return len > 0 ? text[len - 1] : 0;
+}
+
+// join_sentences() over pieces [lo, hi), with piece 'k' replaced by 'edited'.
+static char* region_join(const Document* doc, int lo, int hi, int k, const char* edited) {
+    long total = 1;
+    for (int i = lo; i < hi; i++) {
+        total += (i == k ? (long)strlen(edited) : doc->pieces[i].len) + 1;
+    }
+    char* out = (char*)malloc(total);
+    long pos = 0;
+    for (int i = lo; i < hi; i++) {
+        const char* text = (i == k) ? edited : doc->pieces[i].text;
+        long len = (i == k) ? (long)strlen(edited) : doc->pieces[i].len;
+        memcpy(out + pos, text, len);
+        pos += len;
+        if (i < hi - 1) {
+            const char* next = (i + 1 == k) ? edited : doc->pieces[i + 1].text;
+            long next_len = (i + 1 == k) ? (long)strlen(edited) : doc->pieces[i + 1].len;
+            if (next_len == 0 || next[0] != ' ') out[pos++] = ' ';
+        }
+    }
+    out[pos] = '\0';
+    return out;
+}
+
+void doc_init(Document* doc, const char* base, const SentenceSpan* spans, int count) {
+    memset(doc, 0, sizeof(Document));
+    doc_reserve(doc, count + 1);
+    for (int i = 0; i < count; i++) {
+        doc->pieces[i].text = base + spans[i].start;
+        doc->pieces[i].len = spans[i].length;
+        // Span word counts include the closing delimiter
+        doc->pieces[i].words = spans[i].words - (spans[i].length > 0 && is_delimiter(doc->pieces[i].text[spans[i].length - 1]));
+    }
+    doc->count = count;
+}
+
+int doc_apply_update(Document* doc, int sent_num, int word_idx, const char* new_content) {
+    if (sent_num < 0 || sent_num > doc->count) return -1;
+
+    char* sentence = (sent_num < doc->count) ? strndup(doc->pieces[sent_num].text, doc->pieces[sent_num].len)
+                                             : strdup("");
+    int word_count = 0;
+    char** words = split_into_words(sentence, &word_count);
+    free(sentence);
+    if (word_idx < 0 || word_idx > word_count) {
+        free_split_string(words, word_count);
+        return -1;
+    }
+    int new_word_count = 0;
+    char** new_words = split_string(new_content, " ", &new_word_count);
+
+    char** final_words = (char**)malloc((word_count + new_word_count + 1) * sizeof(char*));
+    int n = 0;
+    for (int i = 0; i < word_idx; i++) final_words[n++] = words[i];
+    for (int i = 0; i < new_word_count; i++) final_words[n++] = new_words[i];
+    for (int i = word_idx; i < word_count; i++) final_words[n++] = words[i];
+    char* edited = join_words(final_words, n);
+    free(final_words);
+    free_split_string(words, word_count);
+    free_split_string(new_words, new_word_count);
+
+    if (sent_num == doc->count) {
+        // Appending: the new sentence starts out empty
+        doc_reserve(doc, doc->count + 1);
+        doc->pieces[doc->count].text = "";
+        doc->pieces[doc->count].len = 0;
+        doc->pieces[doc->count].words = 0;
+        doc->count++;
+    }
+
+    // Re-split only the sentences the edit can reach: an unfinished sentence
+    // just before it, and the next one if the edit leaves its end open.
+    int lo = sent_num, hi = sent_num + 1;
+    if (lo > 0 && !is_delimiter(last_visible(doc->pieces[lo - 1].text, doc->pieces[lo - 1].len))) lo--;
+    char* region = region_join(doc, lo, hi, sent_num, edited);
+    while (hi < doc->count) {
+        char last = last_visible(region, strlen(region));
+        int open = last ? !is_delimiter(last) : (lo == 0);
+        if (!open) break;
+        hi++;
+        free(region);
+        region = region_join(doc, lo, hi, sent_num, edited);
+    }
+    free(edited);
+
+    const char* text = region;
+    if (lo > 0) {
+        while (isspace((unsigned char)*text)) text++; // Belongs to the preceding delimiter
+    }
+    int sentence_count = 0;
+    char** sentences = split_into_sentences(text, &sentence_count);
+    doc_splice(doc, lo, hi, sentences, sentence_count);
+    free(sentences);
+    free(region);
+    return 0;
+}
+
+// True if inserting 'content' can't create or remove a sentence boundary by
+// itself: no delimiters, and no whitespace that split_string() keeps.
+static int update_is_plain(const char* content) {
+    for (const char* p = content; *p; p++) {
+        if (is_delimiter(*p) || (*p != ' ' && isspace((unsigned char)*p))) return 0;
+    }
+    return 1;
+}
+
+// Writes the batched token list back as the text of sentence 'sent_num'.
+static void doc_store_tokens(Document* doc, int sent_num, char** tokens, int token_count) {
+    char* text = join_words(tokens, token_count);
+    DocPiece* piece = &doc->pieces[sent_num];
+    piece->text = doc_own(doc, text);
+    piece->len = strlen(text);
+    piece->words = count_words(text, piece->len);
+}
+
+int doc_apply_updates(Document* doc, int sent_num, const DocUpdate* updates) {
+    char** tokens = NULL; // Target sentence as split_into_words() tokens, while batching
+    int token_count = 0;
+    int batching = 0;
+
+    for (const DocUpdate* u = updates; u && u->sentence == updates->sentence; u = u->next) {
+        if (!batching && sent_num >= 0 && sent_num < doc->count) {
+            char* sentence = strndup(doc->pieces[sent_num].text, doc->pieces[sent_num].len);
+            tokens = split_into_words(sentence, &token_count);
+            free(sentence);
+            batching = 1;
+        }
+        // Words inserted before the closing delimiter (or into an unfinished
+        // sentence) leave the sentence boundaries where they are
+        if (batching && update_is_plain(u->content) && u->word_idx >= 0 && u->word_idx <= token_count &&
+            !(u->word_idx == token_count && token_count > 0 && is_delimiter(tokens[token_count - 1][0]))) {
+            int new_count = 0;
+            char** new_words = split_string(u->content, " ", &new_count);
+            tokens = (char**)realloc(tokens, (token_count + new_count + 1) * sizeof(char*));
+            memmove(&tokens[u->word_idx + new_count], &tokens[u->word_idx], (token_count - u->word_idx) * sizeof(char*));
+            for (int i = 0; i < new_count; i++) tokens[u->word_idx + i] = new_words[i];
+            token_count += new_count;
+            free(new_words); // The strings now belong to 'tokens'
+            continue;
+        }
+
+        if (batching) {
+            doc_store_tokens(doc, sent_num, tokens, token_count);
+            free_split_string(tokens, token_count);
+            tokens = NULL;
+            batching = 0;
+        }
+        if (doc_apply_update(doc, sent_num, u->word_idx, u->content) < 0) return -1;
+    }
+
+    if (batching) {
+        doc_store_tokens(doc, sent_num, tokens, token_count);
+        free_split_string(tokens, token_count);
+    }
+    return 0;
+}
+
+void doc_checkpoint(const Document* doc, DocPiece** saved, int* count) {
+    *saved = (DocPiece*)realloc(*saved, (doc->count + 1) * sizeof(DocPiece));
+    memcpy(*saved, doc->pieces, doc->count * sizeof(DocPiece));
+    *count = doc->count;
+}
+
+void doc_restore(Document* doc, const DocPiece* saved, int count) {
+    doc_reserve(doc, count);
+    memcpy(doc->pieces, saved, count * sizeof(DocPiece));
+    doc->count = count;
+}
+
+char* doc_serialize(const Document* doc, long* len, int* words) {
+    long total = 0;
+    int word_total = 0;
+    for (int i = 0; i < doc->count; i++) {
+        total += doc->pieces[i].len + 1;
+        word_total += doc->pieces[i].words; // Pieces are space-separated, so no word spans two
+    }
+    char* out = (char*)malloc(total + 1);
+    long pos = 0;
+    for (int i = 0; i < doc->count; i++) {
+        memcpy(out + pos, doc->pieces[i].text, doc->pieces[i].len);
+        pos += doc->pieces[i].len;
+        if (i < doc->count - 1 && (doc->pieces[i + 1].len == 0 || doc->pieces[i + 1].text[0] != ' ')) {
+            out[pos++] = ' ';
+        }
+    }
+    out[pos] = '\0';
+    if (len) *len = pos;
+    if (words) *words = word_total;
+    return out;
+}
+
+void doc_free(Document* doc) {
+    for (int i = 0; i < doc->owned_count; i++) free(doc->owned[i]);
+    free(doc->owned);
+    free(doc->pieces);
+    memset(doc, 0, sizeof(Document));
+}
@@ -0,0 +1,197 @@
+#include "durability.h"
+#include "segment_store.h"
+
+static const char* durability_names[] = { "none", "async", "sync" };
+
+int ss_parse_durability(const char* name) {
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, durability_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char* ss_durability_name(Durability d) {
+    return durability_names[d];
+}
+
+static int fsync_path(const char* path, int flags) {
+    int fd = open(path, O_RDONLY | flags);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Makes the storage directory's entries (i.e. completed renames) durable.
+static int fsync_storage_dir(StorageServer* ss) {
+    return fsync_path(ss->storage_path, O_DIRECTORY);
+}
+
+static void flush_enqueue(StorageServer* ss, const char* filename) {
+    pthread_mutex_lock(&ss->flush_mutex);
+    FlushRequest* req = ss->flush_pending;
+    while (req && strcmp(req->filename, filename) != 0) req = req->next;
+    if (!req) {
+        req = (FlushRequest*)calloc(1, sizeof(FlushRequest));
+        strncpy(req->filename, filename, MAX_FILENAME_LEN - 1);
+        req->next = ss->flush_pending;
+        ss->flush_pending = req;
+        pthread_cond_signal(&ss->flush_cond);
+    }
+    pthread_mutex_unlock(&ss->flush_mutex);
+}
+
+static void* ss_flusher_thread(void* arg) {
+    StorageServer* ss = (StorageServer*)arg;
+    char log_buf[BUFFER_SIZE];
+    while (1) {
+        pthread_mutex_lock(&ss->flush_mutex);
+        while (!ss->flush_pending) pthread_cond_wait(&ss->flush_cond, &ss->flush_mutex);
+        pthread_mutex_unlock(&ss->flush_mutex);
+
+        usleep(SS_FLUSH_INTERVAL_MS * 1000); // Let commits pile up into one batch
+
+        pthread_mutex_lock(&ss->flush_mutex);
+        FlushRequest* batch = ss->flush_pending;
+        ss->flush_pending = NULL;
+        pthread_mutex_unlock(&ss->flush_mutex);
+
+        int files = 0;
+        while (batch) {
+            FlushRequest* next = batch->next;
+            char filepath[MAX_PATH_LEN];
+            snprintf(filepath, sizeof(filepath), "%s/%s", ss->storage_path, batch->filename);
+            int rc = ss_segments_fsync(ss, batch->filename);
+            if (rc == 1) rc = fsync_path(filepath, 0);
+            // A file deleted since its commit has nothing left to flush
+            if (rc < 0 && errno != ENOENT) {
+                snprintf(log_buf, sizeof(log_buf), "fsync of %s failed: %s", batch->filename, strerror(errno));
+                log_message("SS", log_buf);
+            }
+            files++;
+            free(batch);
+            batch = next;
+        }
+        if (fsync_storage_dir(ss) < 0) {
+            snprintf(log_buf, sizeof(log_buf), "fsync of storage directory failed after %d file(s): %s",
+                     files, strerror(errno));
+            log_message("SS", log_buf);
+        }
+    }
+    return NULL;
+}
+
+int ss_flusher_start(StorageServer* ss) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ss_flusher_thread, ss) != 0) {
+        perror("pthread_create flusher");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+// Makes freshly installed content of 'filename' as durable as 'd' asks.
+static void installed(StorageServer* ss, const char* filename, Durability d) {
+    // The new content is in place either way; a failed directory fsync is
+    // handed to the flusher to retry rather than reported as a failed write
+    if (d == DURABILITY_ASYNC || (d == DURABILITY_SYNC && fsync_storage_dir(ss) < 0)) {
+        flush_enqueue(ss, filename);
+    }
+}
+
+// Renames the (already fsynced, for sync) temp file into place.
+static int install_temp(StorageServer* ss, const char* tmp_path, const char* filename, Durability d) {
+    char filepath[MAX_PATH_LEN];
+    snprintf(filepath, sizeof(filepath), "%s/%s", ss->storage_path, filename);
+    if (rename(tmp_path, filepath) != 0) {
+        perror("rename commit");
+        unlink(tmp_path);
+        return -1;
+    }
+    installed(ss, filename, d);
+    return 0;
+}
+
+// Segmented mode writes every file it rewrites as segments; files already
+// segmented stay so in either mode.
+static int use_segments(StorageServer* ss, const char* filename) {
+    return ss->segmented || ss_is_segmented(ss, filename);
+}
+
+int ss_write_file_atomic(StorageServer* ss, const char* filename, const char* data, long len, Durability d) {
+    if (use_segments(ss, filename)) {
+        if (ss_segments_write(ss, filename, data, len, d) != 0) return -1;
+        installed(ss, filename, d);
+        return 0;
+    }
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.commit", ss->storage_path, filename);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return -1;
+
+    long written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    int ok = (written == len) && (d != DURABILITY_SYNC || fsync(fd) == 0);
+    if (close(fd) != 0) ok = 0;
+    if (!ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return install_temp(ss, tmp_path, filename, d);
+}
+
+int ss_install_file(StorageServer* ss, const char* tmp_path, const char* filename, Durability d) {
+    if (use_segments(ss, filename)) {
+        char* content = get_file_content(tmp_path);
+        int rc = content ? ss_write_file_atomic(ss, filename, content, (long)strlen(content), d) : -1;
+        free(content);
+        unlink(tmp_path);
+        return rc;
+    }
+    if (d == DURABILITY_SYNC && fsync_path(tmp_path, 0) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return install_temp(ss, tmp_path, filename, d);
+}
+
+int ss_append_file(StorageServer* ss, const char* filename, const char* data, long len, Durability d) {
+    if (ss_is_segmented(ss, filename)) {
+        if (ss_segments_append(ss, filename, data, len, d) != 0) return -1;
+        installed(ss, filename, d);
+        return 0;
+    }
+    char filepath[MAX_PATH_LEN];
+    snprintf(filepath, sizeof(filepath), "%s/%s", ss->storage_path, filename);
+    int fd = open(filepath, O_WRONLY | O_APPEND);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    long written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    int ok = (written == len) && (d != DURABILITY_SYNC || fdatasync(fd) == 0);
+    if (!ok && ftruncate(fd, st.st_size) < 0) perror("ftruncate append");
+    if (close(fd) != 0) ok = 0;
+    if (!ok) return -1;
+    if (d == DURABILITY_ASYNC) flush_enqueue(ss, filename);
+    return 0;
+}
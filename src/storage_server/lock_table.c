@@ -0,0 +1,317 @@
+#include "storage_server.h"
+
+// Per-file lock objects in a sharded hash table. A lookup only takes the
+// mutex of the file's shard, and an object lives exactly as long as it is
+// referenced (waiters included), holds sentence locks or is fenced.
+
+static unsigned long long lock_hash(const char* filename) {
+    unsigned long long hash = 1469598103934665603ULL;
+    while (*filename) {
+        hash ^= (unsigned char)*filename++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static LockShard* lock_shard(StorageServer* ss, unsigned long long hash) {
+    return &ss->lock_shards[hash % SS_LOCK_SHARDS];
+}
+
+static FileLock** lock_bucket(LockShard* shard, unsigned long long hash) {
+    return &shard->buckets[(hash / SS_LOCK_SHARDS) % SS_LOCK_BUCKETS];
+}
+
+// Caller holds the shard mutex.
+static FileLock* lock_find(LockShard* shard, const char* filename, unsigned long long hash) {
+    FileLock* lock = *lock_bucket(shard, hash);
+    while (lock && (lock->hash != hash || strcmp(lock->filename, filename) != 0)) lock = lock->next;
+    return lock;
+}
+
+// Caller holds the shard mutex.
+static FileLock* lock_find_or_create(LockShard* shard, const char* filename, unsigned long long hash) {
+    FileLock* lock = lock_find(shard, filename, hash);
+    if (lock) return lock;
+    lock = (FileLock*)calloc(1, sizeof(FileLock));
+    lock->filename = strdup(filename);
+    lock->hash = hash;
+    pthread_mutex_init(&lock->commit, NULL);
+    FileLock** bucket = lock_bucket(shard, hash);
+    lock->next = *bucket;
+    *bucket = lock;
+    return lock;
+}
+
+// Frees 'lock' if nothing keeps it alive. Caller holds the shard mutex.
+static void lock_reclaim(LockShard* shard, FileLock* lock) {
+    if (lock->refs > 0 || lock->sentence_count > 0 || lock->fenced) return;
+    FileLock** link = lock_bucket(shard, lock->hash);
+    while (*link != lock) link = &(*link)->next;
+    *link = lock->next;
+    pthread_mutex_destroy(&lock->commit);
+    free(lock->shift_tree);
+    free(lock->sentences);
+    free(lock->filename);
+    free(lock);
+}
+
+void ss_locks_init(StorageServer* ss) {
+    for (int i = 0; i < SS_LOCK_SHARDS; i++) {
+        pthread_mutex_init(&ss->lock_shards[i].mutex, NULL);
+    }
+}
+
+FileLock* ss_commit_lock(StorageServer* ss, const char* filename) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find_or_create(shard, filename, hash);
+    lock->refs++;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_mutex_lock(&lock->commit);
+    return lock;
+}
+
+FileLock* ss_commit_join(StorageServer* ss, const char* filename, CommitRequest* req) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find_or_create(shard, filename, hash);
+    lock->refs++;
+    req->done = 0;
+    req->next = NULL;
+    if (lock->pending_tail) lock->pending_tail->next = req;
+    else lock->pending = req;
+    lock->pending_tail = req;
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_mutex_lock(&lock->commit);
+    return lock;
+}
+
+CommitRequest* ss_commit_take(StorageServer* ss, FileLock* lock) {
+    LockShard* shard = lock_shard(ss, lock->hash);
+    pthread_mutex_lock(&shard->mutex);
+    CommitRequest* batch = lock->pending;
+    lock->pending = lock->pending_tail = NULL;
+    pthread_mutex_unlock(&shard->mutex);
+    return batch;
+}
+
+void ss_commit_unlock(StorageServer* ss, FileLock* lock) {
+    pthread_mutex_unlock(&lock->commit);
+    LockShard* shard = lock_shard(ss, lock->hash);
+    pthread_mutex_lock(&shard->mutex);
+    lock->refs--;
+    lock_reclaim(shard, lock);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Caller holds the shard mutex.
+static int sentence_locked(const FileLock* lock, int sent_num) {
+    for (int i = 0; i < lock->sentence_count; i++) {
+        if (lock->sentences[i] == sent_num) return 1;
+    }
+    return 0;
+}
+
+// True if none of 'sents' is locked or wanted by a waiter queued ahead of
+// 'until' (NULL: by any waiter). Caller holds the shard mutex.
+static int sentences_free(const FileLock* lock, const int* sents, int count, const LockWaiter* until) {
+    for (int i = 0; i < count; i++) {
+        if (sentence_locked(lock, sents[i])) return 0;
+        for (const LockWaiter* w = lock->waiters; w != until; w = w->next) {
+            for (int j = 0; j < w->count; j++) {
+                if (w->sents[j] == sents[i]) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Caller holds the shard mutex.
+static void sentences_take(FileLock* lock, const int* sents, int count) {
+    if (lock->sentence_count + count > lock->sentence_capacity) {
+        while (lock->sentence_count + count > lock->sentence_capacity) {
+            lock->sentence_capacity = lock->sentence_capacity ? lock->sentence_capacity * 2 : 4;
+        }
+        lock->sentences = (int*)realloc(lock->sentences, lock->sentence_capacity * sizeof(int));
+    }
+    for (int i = 0; i < count; i++) lock->sentences[lock->sentence_count++] = sents[i];
+}
+
+// Caller holds the shard mutex.
+static void waiter_unlink(FileLock* lock, LockWaiter* waiter) {
+    LockWaiter* prev = NULL;
+    LockWaiter** link = &lock->waiters;
+    while (*link != waiter) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    *link = waiter->next;
+    if (lock->waiters_tail == waiter) lock->waiters_tail = prev;
+}
+
+// Hands locks to queued waiters, oldest first. A waiter is skipped while a
+// sentence it wants is locked or wanted by an older waiter, so nobody is
+// overtaken on a sentence. Caller holds the shard mutex.
+static void grant_waiters(FileLock* lock) {
+    LockWaiter* w = lock->waiters;
+    while (w) {
+        LockWaiter* next = w->next;
+        if (sentences_free(lock, w->sents, w->count, w)) {
+            waiter_unlink(lock, w);
+            sentences_take(lock, w->sents, w->count);
+            w->granted = 1;
+            pthread_cond_signal(&w->ready);
+        }
+        w = next;
+    }
+}
+
+// All or nothing, under one mutex: a session never holds some of its
+// sentences while waiting for others, so sessions can't deadlock each other.
+int lock_sentences(StorageServer* ss, const char* filename, const int* sents, int count, int wait_ms) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find_or_create(shard, filename, hash);
+    if (sentences_free(lock, sents, count, NULL)) {
+        sentences_take(lock, sents, count);
+        pthread_mutex_unlock(&shard->mutex);
+        return 1;
+    }
+    if (wait_ms <= 0) {
+        lock_reclaim(shard, lock);
+        pthread_mutex_unlock(&shard->mutex);
+        return 0;
+    }
+
+    LockWaiter waiter = { .sents = sents, .count = count };
+    pthread_cond_init(&waiter.ready, NULL);
+    if (lock->waiters_tail) lock->waiters_tail->next = &waiter;
+    else lock->waiters = &waiter;
+    lock->waiters_tail = &waiter;
+    lock->refs++;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (!waiter.granted) {
+        if (pthread_cond_timedwait(&waiter.ready, &shard->mutex, &deadline) == ETIMEDOUT && !waiter.granted) {
+            waiter_unlink(lock, &waiter);
+            grant_waiters(lock); // Those queued behind it only on its account can go now
+            break;
+        }
+    }
+    pthread_cond_destroy(&waiter.ready);
+    lock->refs--;
+    lock_reclaim(shard, lock);
+    pthread_mutex_unlock(&shard->mutex);
+    return waiter.granted;
+}
+
+void unlock_sentences(StorageServer* ss, const char* filename, const int* sents, int count) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find(shard, filename, hash);
+    if (lock) {
+        for (int k = 0; k < count; k++) {
+            for (int i = 0; i < lock->sentence_count; i++) {
+                if (lock->sentences[i] == sents[k]) {
+                    lock->sentences[i] = lock->sentences[--lock->sentence_count];
+                    break;
+                }
+            }
+        }
+        grant_waiters(lock);
+        // No session left that could ask for a shift
+        if (lock->sentence_count == 0) {
+            free(lock->shift_tree);
+            lock->shift_tree = NULL;
+            lock->shift_size = 0;
+        }
+        lock_reclaim(shard, lock);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Caller should hold the file's commit lock when raising the fence, so that
+// no commit is in flight once the NM sees the FENCE acknowledged.
+void set_file_fenced(StorageServer* ss, const char* filename, int fenced) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = fenced ? lock_find_or_create(shard, filename, hash) : lock_find(shard, filename, hash);
+    if (lock) {
+        lock->fenced = fenced;
+        lock_reclaim(shard, lock);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+int is_file_fenced(StorageServer* ss, const char* filename) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find(shard, filename, hash);
+    int fenced = lock ? lock->fenced : 0;
+    pthread_mutex_unlock(&shard->mutex);
+    return fenced;
+}
+
+// --- SENTENCE SHIFTS ---
+// A session remembers the prefix sum below its sentence when it starts; the
+// shift at commit is how much that prefix sum has grown since.
+
+// Sum of the deltas logged at indices [0, end). Caller holds the shard mutex.
+static int shift_prefix(const FileLock* lock, int end) {
+    if (end > lock->shift_size) end = lock->shift_size;
+    int sum = 0;
+    for (int i = end; i > 0; i -= i & -i) sum += lock->shift_tree[i];
+    return sum;
+}
+
+// Caller holds the shard mutex.
+static void shift_add(FileLock* lock, int index, int delta) {
+    while (index >= lock->shift_size) {
+        // Doubling a power-of-two tree keeps every node; the new top node
+        // covers everything, i.e. the old top node.
+        int old_size = lock->shift_size;
+        int new_size = old_size ? old_size * 2 : 16;
+        lock->shift_tree = (int*)realloc(lock->shift_tree, (new_size + 1) * sizeof(int));
+        memset(lock->shift_tree + old_size + 1, 0, (new_size - old_size) * sizeof(int));
+        if (old_size) lock->shift_tree[new_size] = lock->shift_tree[old_size];
+        lock->shift_size = new_size;
+    }
+    for (int i = index + 1; i <= lock->shift_size; i += i & -i) lock->shift_tree[i] += delta;
+}
+
+void log_modification(StorageServer* ss, const char* filename, int index, int delta) {
+    if (delta == 0 || index < 0) return;
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find(shard, filename, hash);
+    if (lock && lock->sentence_count > 0) shift_add(lock, index, delta);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+int get_shift_mark(StorageServer* ss, const char* filename, int original_index) {
+    unsigned long long hash = lock_hash(filename);
+    LockShard* shard = lock_shard(ss, hash);
+    pthread_mutex_lock(&shard->mutex);
+    FileLock* lock = lock_find(shard, filename, hash);
+    int mark = lock ? shift_prefix(lock, original_index) : 0;
+    pthread_mutex_unlock(&shard->mutex);
+    return mark;
+}
+
+int get_sentence_shift(StorageServer* ss, const char* filename, int original_index, int mark) {
+    return get_shift_mark(ss, filename, original_index) - mark;
+}
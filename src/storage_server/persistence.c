@@ -1,40 +1,425 @@
 #include "persistence.h"
 #include "storage_server.h"
+#include "segment_store.h"
+#include <sched.h>
 
-// Scans directory and returns a string like "[file1,file2,file3]"
-char* ss_scan_directory(const char* path) {
-    char* file_list_str = (char*)calloc(BUFFER_SIZE, 1);
-    if (!file_list_str) return NULL;
-    
-    strcat(file_list_str, "[");
-    
-    DIR* d = opendir(path);
+// --- FILE MANIFEST ---
+// In memory the manifest is a hash table of ManifestEntry guarded by
+// manifest_mutex. On disk it is a snapshot (.manifest) plus a journal of
+// changes since (.manifest.journal), so a commit costs one appended line and a
+// restart costs one stat() per file instead of reading every file.
+
+unsigned long long fnv1a64(unsigned long long hash, const char* data, long len) {
+    for (long i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static unsigned int manifest_hash(const char* filename, int capacity) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *filename++)) hash = ((hash << 5) + hash) + c;
+    return hash % capacity;
+}
+
+// Files that are ours, not user files: the manifest itself, undo backups,
+// half-finished sync transfers.
+static int is_internal_file(const char* name) {
+    return name[0] == '.' || strstr(name, ".undo") != NULL || strstr(name, ".sync") != NULL;
+}
+
+// Caller holds manifest_mutex.
+static ManifestEntry* manifest_find(StorageServer* ss, const char* filename) {
+    ManifestEntry* e = ss->manifest_buckets[manifest_hash(filename, ss->manifest_capacity)];
+    while (e && strcmp(e->filename, filename) != 0) e = e->next;
+    return e;
+}
+
+// Caller holds manifest_mutex.
+static void manifest_grow(StorageServer* ss) {
+    int new_capacity = ss->manifest_capacity * 2;
+    ManifestEntry** buckets = (ManifestEntry**)calloc(new_capacity, sizeof(ManifestEntry*));
+    if (!buckets) return; // Keep the longer chains
+    for (int b = 0; b < ss->manifest_capacity; b++) {
+        ManifestEntry* e = ss->manifest_buckets[b];
+        while (e) {
+            ManifestEntry* next = e->next;
+            unsigned int idx = manifest_hash(e->filename, new_capacity);
+            e->next = buckets[idx];
+            buckets[idx] = e;
+            e = next;
+        }
+    }
+    free(ss->manifest_buckets);
+    ss->manifest_buckets = buckets;
+    ss->manifest_capacity = new_capacity;
+}
+
+// Returns the entry for 'filename', creating an empty one if needed.
+// Caller holds manifest_mutex.
+static ManifestEntry* manifest_upsert(StorageServer* ss, const char* filename) {
+    ManifestEntry* e = manifest_find(ss, filename);
+    if (e) return e;
+    if (ss->manifest_count >= ss->manifest_capacity) manifest_grow(ss);
+    e = (ManifestEntry*)calloc(1, sizeof(ManifestEntry));
+    e->filename = strdup(filename);
+    unsigned int idx = manifest_hash(filename, ss->manifest_capacity);
+    e->next = ss->manifest_buckets[idx];
+    ss->manifest_buckets[idx] = e;
+    ss->manifest_count++;
+    return e;
+}
+
+// Caller holds manifest_mutex.
+static void manifest_delete(StorageServer* ss, const char* filename) {
+    unsigned int idx = manifest_hash(filename, ss->manifest_capacity);
+    ManifestEntry* e = ss->manifest_buckets[idx];
+    ManifestEntry* prev = NULL;
+    while (e) {
+        if (strcmp(e->filename, filename) == 0) {
+            if (prev) {
+                prev->next = e->next;
+            } else {
+                ss->manifest_buckets[idx] = e->next;
+            }
+            free(e->filename);
+            free(e);
+            ss->manifest_count--;
+            return;
+        }
+        prev = e;
+        e = e->next;
+    }
+}
+
+static void manifest_path(StorageServer* ss, const char* name, char* out, int size) {
+    snprintf(out, size, "%s/%s", ss->storage_path, name);
+}
+
+static void format_entry(const ManifestEntry* e, char* out, int size) {
+    snprintf(out, size, "%s|%ld|%d|%d|%ld|%ld|%llu", e->filename, e->size, e->words, e->chars,
+             (long)e->mtime, e->version, e->checksum);
+}
+
+// Parses "name|size|words|chars|mtime|version|checksum" in place (fields are
+// read from the right, so names may contain '|') and stores it.
+static void parse_and_store(StorageServer* ss, char* line) {
+    char* fields[6];
+    for (int i = 5; i >= 0; i--) {
+        char* sep = strrchr(line, '|');
+        if (!sep) return;
+        *sep = '\0';
+        fields[i] = sep + 1;
+    }
+    if (line[0] == '\0') return;
+    ManifestEntry* e = manifest_upsert(ss, line);
+    e->size = atol(fields[0]);
+    e->words = atoi(fields[1]);
+    e->chars = atoi(fields[2]);
+    e->mtime = (time_t)atol(fields[3]);
+    e->version = atol(fields[4]);
+    e->checksum = strtoull(fields[5], NULL, 10);
+}
+
+// Fills the stats of 'e' from 'content' and the file's current mtime.
+// 'words' < 0 means count them from 'content'.
+static void fill_entry(StorageServer* ss, ManifestEntry* e, const char* content, long len, int words) {
+    struct stat st;
+    int found = ss_file_stat(ss, e->filename, &st) == 0;
+    e->mtime = found ? st.st_mtime : time(NULL);
+    e->ino = found ? st.st_ino : 0;
+    e->size = len;
+    e->words = words < 0 ? count_words(content, len) : words;
+    e->chars = (int)len;
+    e->checksum = fnv1a64(FNV1A64_INIT, content, len);
+}
+
+// Reads 'filename' and (re)computes its entry. Caller holds manifest_mutex.
+// Returns the entry, or NULL if the file can't be read.
+static ManifestEntry* manifest_recompute(StorageServer* ss, const char* filename) {
+    long len;
+    char* content = ss_file_load(ss, filename, &len);
+    if (!content) return NULL;
+    ManifestEntry* e = manifest_upsert(ss, filename);
+    e->version++;
+    fill_entry(ss, e, content, len, -1);
+    free(content);
+    return e;
+}
+
+// Rewrites .manifest from memory and starts an empty journal.
+// Caller holds manifest_mutex.
+static void manifest_compact(StorageServer* ss) {
+    char path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN], journal_path[MAX_PATH_LEN];
+    manifest_path(ss, SS_MANIFEST_FILE, path, sizeof(path));
+    manifest_path(ss, SS_MANIFEST_FILE ".tmp", tmp_path, sizeof(tmp_path));
+    manifest_path(ss, SS_MANIFEST_JOURNAL, journal_path, sizeof(journal_path));
+
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) {
+        perror("fopen manifest");
+        return;
+    }
+    char line[MAX_PATH_LEN];
+    for (int b = 0; b < ss->manifest_capacity; b++) {
+        for (ManifestEntry* e = ss->manifest_buckets[b]; e; e = e->next) {
+            format_entry(e, line, sizeof(line));
+            fprintf(f, "%s\n", line);
+        }
+    }
+    if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+        perror("write manifest");
+        unlink(tmp_path);
+        return;
+    }
+
+    // The snapshot now covers everything the journal held
+    if (ss->manifest_journal) fclose(ss->manifest_journal);
+    ss->manifest_journal = fopen(journal_path, "w");
+    ss->journal_records = 0;
+}
+
+// Caller holds manifest_mutex.
+static void journal_append(StorageServer* ss, const char* record) {
+    if (!ss->manifest_journal) return;
+    fprintf(ss->manifest_journal, "%s\n", record);
+    fflush(ss->manifest_journal);
+    if (++ss->journal_records >= SS_MANIFEST_COMPACT_RECORDS) {
+        manifest_compact(ss);
+    }
+}
+
+// Caller holds manifest_mutex.
+static void journal_put(StorageServer* ss, const ManifestEntry* e) {
+    char line[MAX_PATH_LEN];
+    line[0] = 'U';
+    line[1] = ' ';
+    format_entry(e, line + 2, sizeof(line) - 2);
+    journal_append(ss, line);
+}
+
+// One-time full scan, used when there is no manifest yet.
+static void manifest_rebuild_from_directory(StorageServer* ss) {
+    DIR* d = opendir(ss->storage_path);
     if (!d) {
         perror("opendir");
-        strcat(file_list_str, "]");
-        return file_list_str;
+        return;
     }
-    
     struct dirent* dir;
-    int first = 1;
     while ((dir = readdir(d)) != NULL) {
-        // Skip . and ..
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) {
+        // A segmented file shows up as its ".<name>.segidx"
+        size_t len = strlen(dir->d_name);
+        if (dir->d_name[0] == '.' && len > 8 && strcmp(dir->d_name + len - 7, ".segidx") == 0) {
+            char filename[MAX_FILENAME_LEN];
+            snprintf(filename, sizeof(filename), "%.*s", (int)(len - 8), dir->d_name + 1);
+            if (ss_is_segmented(ss, filename)) manifest_recompute(ss, filename);
             continue;
         }
-        // Skip .undo files
-        if (strstr(dir->d_name, ".undo") != NULL) {
-            continue;
+        if (is_internal_file(dir->d_name)) continue;
+        char filepath[MAX_PATH_LEN];
+        manifest_path(ss, dir->d_name, filepath, sizeof(filepath));
+        struct stat st;
+        if (stat(filepath, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        manifest_recompute(ss, dir->d_name);
+    }
+    closedir(d);
+}
+
+void ss_manifest_load(StorageServer* ss) {
+    char path[MAX_PATH_LEN], journal_path[MAX_PATH_LEN];
+    char line[MAX_PATH_LEN];
+    char log_buf[BUFFER_SIZE];
+    manifest_path(ss, SS_MANIFEST_FILE, path, sizeof(path));
+    manifest_path(ss, SS_MANIFEST_JOURNAL, journal_path, sizeof(journal_path));
+
+    pthread_mutex_lock(&ss->manifest_mutex);
+    FILE* f = fopen(path, "r");
+    FILE* journal = fopen(journal_path, "r");
+    int rebuilt = 0, refreshed = 0, dropped = 0;
+
+    if (!f && !journal) {
+        manifest_rebuild_from_directory(ss);
+        rebuilt = 1;
+    } else {
+        if (f) {
+            while (fgets(line, sizeof(line), f)) {
+                trim_newline(line);
+                parse_and_store(ss, line);
+            }
+            fclose(f);
         }
-        
-        if (!first) {
-            strcat(file_list_str, ",");
+        if (journal) {
+            // "U <entry>" upserts, "D <name>" removes; a torn last line is skipped
+            while (fgets(line, sizeof(line), journal)) {
+                if (line[strlen(line) - 1] != '\n') break;
+                trim_newline(line);
+                if (strncmp(line, "U ", 2) == 0) {
+                    parse_and_store(ss, line + 2);
+                } else if (strncmp(line, "D ", 2) == 0) {
+                    manifest_delete(ss, line + 2);
+                }
+            }
+        }
+
+        // Cheap validation: only files whose mtime or size moved are re-read
+        for (int b = 0; b < ss->manifest_capacity; b++) {
+            ManifestEntry* e = ss->manifest_buckets[b];
+            while (e) {
+                ManifestEntry* next = e->next;
+                struct stat st;
+                if (ss_file_stat(ss, e->filename, &st) != 0) {
+                    manifest_delete(ss, e->filename);
+                    dropped++;
+                } else if (st.st_mtime != e->mtime || st.st_size != e->size) {
+                    manifest_recompute(ss, e->filename);
+                    refreshed++;
+                } else {
+                    e->ino = st.st_ino;
+                }
+                e = next;
+            }
         }
-        strcat(file_list_str, dir->d_name);
-        first = 0;
     }
-    closedir(d);
-    
-    strcat(file_list_str, "]");
-    return file_list_str;
-}
\ No newline at end of file
+    if (journal) fclose(journal);
+    manifest_compact(ss);
+    int count = ss->manifest_count;
+    pthread_mutex_unlock(&ss->manifest_mutex);
+
+    snprintf(log_buf, sizeof(log_buf), "Manifest %s: %d file(s), %d refreshed, %d dropped",
+             rebuilt ? "rebuilt from directory" : "loaded", count, refreshed, dropped);
+    log_message("SS", log_buf);
+}
+
+void ss_manifest_put(StorageServer* ss, const char* filename, const char* content, long len, int words, ManifestEntry* out) {
+    pthread_mutex_lock(&ss->manifest_mutex);
+    ManifestEntry* e = manifest_upsert(ss, filename);
+    e->version++;
+    fill_entry(ss, e, content, len, words);
+    if (out) *out = *e;
+    journal_put(ss, e);
+    pthread_mutex_unlock(&ss->manifest_mutex);
+}
+
+void ss_manifest_append(StorageServer* ss, const char* filename, long before_len, const char* added, long added_len,
+                        ManifestEntry* out) {
+    pthread_mutex_lock(&ss->manifest_mutex);
+    ManifestEntry* e = manifest_find(ss, filename);
+    if (e && e->size == before_len) {
+        struct stat st;
+        int found = ss_file_stat(ss, filename, &st) == 0;
+        e->version++;
+        e->mtime = found ? st.st_mtime : time(NULL);
+        e->ino = found ? st.st_ino : 0;
+        e->size += added_len;
+        e->chars += (int)added_len;
+        e->words += count_words(added, added_len); // 'added' starts a new word
+        e->checksum = fnv1a64(e->checksum, added, added_len);
+    } else {
+        e = manifest_recompute(ss, filename); // Not what the appender saw; count it all
+    }
+    if (e) {
+        if (out) *out = *e;
+        journal_put(ss, e);
+    }
+    pthread_mutex_unlock(&ss->manifest_mutex);
+}
+
+int ss_manifest_refresh(StorageServer* ss, const char* filename, ManifestEntry* out) {
+    pthread_mutex_lock(&ss->manifest_mutex);
+    ManifestEntry* e = manifest_recompute(ss, filename);
+    if (e) {
+        if (out) *out = *e;
+        journal_put(ss, e);
+    }
+    pthread_mutex_unlock(&ss->manifest_mutex);
+    return e != NULL;
+}
+
+void ss_manifest_remove(StorageServer* ss, const char* filename) {
+    char line[MAX_PATH_LEN];
+    pthread_mutex_lock(&ss->manifest_mutex);
+    if (manifest_find(ss, filename)) {
+        manifest_delete(ss, filename);
+        snprintf(line, sizeof(line), "D %s", filename);
+        journal_append(ss, line);
+    }
+    pthread_mutex_unlock(&ss->manifest_mutex);
+}
+
+long ss_manifest_version(StorageServer* ss, const char* filename) {
+    pthread_mutex_lock(&ss->manifest_mutex);
+    ManifestEntry* e = manifest_find(ss, filename);
+    long version = e ? e->version : -1;
+    pthread_mutex_unlock(&ss->manifest_mutex);
+    return version;
+}
+
+int ss_open_view(StorageServer* ss, const char* filename, FileView* view) {
+    for (int attempt = 0; attempt < SS_OPEN_VERSION_TRIES; attempt++) {
+        pthread_mutex_lock(&ss->manifest_mutex);
+        ManifestEntry* e = manifest_find(ss, filename);
+        long v = e ? e->version : -1;
+        ino_t ino = e ? e->ino : 0;
+        long v_size = e ? e->size : -1;
+        pthread_mutex_unlock(&ss->manifest_mutex);
+
+        ino_t open_ino;
+        if (ss_view_open_current(ss, filename, view, &open_ino) < 0) return -1;
+        // An APPEND may be growing the file past the recorded version
+        if (v >= 0 && ino != 0 && open_ino == ino && view->size >= v_size) {
+            view->version = v;
+            view->size = v_size;
+            return 0;
+        }
+        // Installed by a commit that hasn't recorded it yet, or not tracked at all
+        if (v < 0 || attempt == SS_OPEN_VERSION_TRIES - 1) return 0;
+        ss_view_close(view);
+        sched_yield();
+    }
+    return -1;
+}
+
+// Flushes the pending MANIFEST line, if it holds any entries.
+static int flush_manifest_chunk(int sock, char* chunk, int* len) {
+    if (*len <= (int)strlen("MANIFEST ")) return 0;
+    int result = send_line(sock, chunk);
+    *len = snprintf(chunk, BUFFER_SIZE, "MANIFEST ");
+    return result;
+}
+
+// Streams the files this SS owns to the NM in bounded chunks:
+//   MANIFEST <name>:<size>:<words>:<chars>:<mtime>/<name>:...   (repeated)
+//   MANIFEST_END <file_count>
+// Each line stays under MANIFEST_CHUNK_BYTES, so the file count is unbounded.
+// Returns the number of files reported, or -1 if the NM connection failed.
+int ss_send_manifest(StorageServer* ss, int sock) {
+    char chunk[BUFFER_SIZE];
+    int len = snprintf(chunk, sizeof(chunk), "MANIFEST ");
+    int file_count = 0;
+    int result = 0;
+
+    pthread_mutex_lock(&ss->manifest_mutex);
+    for (int b = 0; b < ss->manifest_capacity && result == 0; b++) {
+        for (ManifestEntry* e = ss->manifest_buckets[b]; e && result == 0; e = e->next) {
+            char entry[MAX_FILENAME_LEN + 96];
+            int entry_len = snprintf(entry, sizeof(entry), "%s:%ld:%d:%d:%ld", e->filename, e->size,
+                                     e->words, e->chars, (long)e->mtime);
+            if (len + entry_len + 1 > MANIFEST_CHUNK_BYTES) {
+                result = flush_manifest_chunk(sock, chunk, &len);
+            }
+            if (len > (int)strlen("MANIFEST ")) chunk[len++] = '/';
+            memcpy(chunk + len, entry, entry_len + 1);
+            len += entry_len;
+            file_count++;
+        }
+    }
+    pthread_mutex_unlock(&ss->manifest_mutex);
+
+    if (result < 0 || flush_manifest_chunk(sock, chunk, &len) < 0) return -1;
+    char end_msg[64];
+    snprintf(end_msg, sizeof(end_msg), "MANIFEST_END %d", file_count);
+    if (send_line(sock, end_msg) < 0) return -1;
+    return file_count;
+}
@@ -0,0 +1,681 @@
+#include "segment_store.h"
+#include "persistence.h"
+#include "text_scan.h"
+#include <sys/sendfile.h>
+
+// --- SEGMENTED FILES ---
+// Every segmented file has a SegmentFile in ss->segment_files, guarded by
+// segment_mutex, holding its current SegmentIndex and any older ones readers
+// still pin. A commit never touches a segment another version lists: it writes
+// new ones under fresh ids and installs a new index, so a reader keeps its
+// version's bytes for as long as it holds that index. Commits to one file are
+// serialized by its commit lock.
+
+// Header of a .segidx; SegmentEntry records follow.
+typedef struct {
+    int magic;
+    int format;
+    long size;
+    long next_id;
+    int count;
+    int reserved;
+} SegidxHeader;
+
+static void segidx_path(StorageServer* ss, const char* filename, char* out, size_t size) {
+    snprintf(out, size, "%s/.%s.segidx", ss->storage_path, filename);
+}
+
+static void segment_path(StorageServer* ss, const char* filename, long id, char* out, size_t size) {
+    snprintf(out, size, "%s/.%s.seg.%ld", ss->storage_path, filename, id);
+}
+
+static unsigned int segment_hash(const char* filename) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *filename++)) hash = ((hash << 5) + hash) + c;
+    return hash % SS_SEGMENT_BUCKETS;
+}
+
+static int sync_path(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int write_all(int fd, const char* data, long len) {
+    long written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += n;
+    }
+    return 0;
+}
+
+static void index_free(SegmentIndex* idx) {
+    if (!idx) return;
+    free(idx->segs);
+    free(idx);
+}
+
+static SegmentIndex* index_new(int capacity) {
+    SegmentIndex* idx = (SegmentIndex*)calloc(1, sizeof(SegmentIndex));
+    idx->segs = (SegmentEntry*)malloc((capacity + 1) * sizeof(SegmentEntry));
+    return idx;
+}
+
+// Recomputes offsets and the document size from the segment lengths.
+static void index_layout(SegmentIndex* idx) {
+    long pos = 0;
+    for (int i = 0; i < idx->count; i++) {
+        idx->segs[i].start = pos;
+        pos += idx->segs[i].len;
+    }
+    idx->size = pos;
+}
+
+// Segment holding byte 'off' (off < idx->size).
+static int index_locate(const SegmentIndex* idx, long off) {
+    int lo = 0, hi = idx->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (idx->segs[mid].start <= off) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+static int compare_ids(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Caller holds segment_mutex.
+static SegmentFile* segfile_find(StorageServer* ss, const char* filename) {
+    SegmentFile* file = ss->segment_files[segment_hash(filename)];
+    while (file && strcmp(file->filename, filename) != 0) file = file->next;
+    return file;
+}
+
+// Caller holds segment_mutex.
+static SegmentFile* segfile_add(StorageServer* ss, const char* filename) {
+    unsigned int b = segment_hash(filename);
+    SegmentFile* file = (SegmentFile*)calloc(1, sizeof(SegmentFile));
+    file->filename = strdup(filename);
+    file->next = ss->segment_files[b];
+    ss->segment_files[b] = file;
+    return file;
+}
+
+// Drops versions nobody reads any more, oldest first, and unlinks the
+// segments only they listed. Frees the file's entry once it is deleted and
+// unpinned. Caller holds segment_mutex.
+static void segfile_prune(StorageServer* ss, SegmentFile* file) {
+    char path[MAX_PATH_LEN];
+    while (file->oldest && file->oldest != file->current && file->oldest->refs == 0) {
+        SegmentIndex* old = file->oldest;
+        SegmentIndex* newer = old->newer;
+        long* kept = NULL;
+        if (newer) {
+            kept = (long*)malloc((newer->count + 1) * sizeof(long));
+            for (int i = 0; i < newer->count; i++) kept[i] = newer->segs[i].id;
+            qsort(kept, newer->count, sizeof(long), compare_ids);
+        }
+        for (int i = 0; i < old->count; i++) {
+            if (kept && bsearch(&old->segs[i].id, kept, newer->count, sizeof(long), compare_ids)) continue;
+            segment_path(ss, file->filename, old->segs[i].id, path, sizeof(path));
+            unlink(path);
+        }
+        free(kept);
+        file->oldest = newer;
+        index_free(old);
+    }
+    if (!file->oldest && !file->current) {
+        SegmentFile** link = &ss->segment_files[segment_hash(file->filename)];
+        while (*link != file) link = &(*link)->next;
+        *link = file->next;
+        free(file->dirty);
+        free(file->filename);
+        free(file);
+    }
+}
+
+// Caller holds segment_mutex.
+static void segfile_mark_dirty(SegmentFile* file, long first_id, long end_id) {
+    for (long id = first_id; id < end_id; id++) {
+        if (file->dirty_count == file->dirty_capacity) {
+            file->dirty_capacity = file->dirty_capacity ? file->dirty_capacity * 2 : 16;
+            file->dirty = (long*)realloc(file->dirty, file->dirty_capacity * sizeof(long));
+        }
+        file->dirty[file->dirty_count++] = id;
+    }
+}
+
+static SegmentIndex* segidx_read(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    SegidxHeader header;
+    struct stat st;
+    SegmentIndex* idx = NULL;
+    if (fread(&header, sizeof(header), 1, f) == 1 && header.magic == SS_SEGIDX_MAGIC &&
+        header.format == SS_SEGIDX_FORMAT && header.count >= 0 && fstat(fileno(f), &st) == 0) {
+        idx = index_new(header.count);
+        if (fread(idx->segs, sizeof(SegmentEntry), header.count, f) == (size_t)header.count) {
+            idx->count = header.count;
+            idx->next_id = header.next_id;
+            idx->ino = st.st_ino;
+            index_layout(idx);
+        }
+        if (idx->count != header.count || idx->size != header.size) {
+            index_free(idx);
+            idx = NULL;
+        }
+    }
+    fclose(f);
+    return idx;
+}
+
+// Writes 'idx' as the file's .segidx through a temp file and rename, and
+// records the inode it was installed as. As for plain files, only sync makes
+// the index (and its segments) durable before the rename, so under none or
+// async a power failure can leave an index that points at missing bytes.
+static int segidx_install(StorageServer* ss, const char* filename, SegmentIndex* idx, Durability d) {
+    char path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN + 8];
+    segidx_path(ss, filename, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    SegidxHeader header = { SS_SEGIDX_MAGIC, SS_SEGIDX_FORMAT, idx->size, idx->next_id, idx->count, 0 };
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) return -1;
+    struct stat st;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(idx->segs, sizeof(SegmentEntry), idx->count, f) == (size_t)idx->count &&
+             fflush(f) == 0 && (d != DURABILITY_SYNC || fsync(fileno(f)) == 0) && fstat(fileno(f), &st) == 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    idx->ino = st.st_ino;
+    return 0;
+}
+
+// Segments are fsynced here only for sync; async leaves them to the flusher.
+static int segment_write(StorageServer* ss, const char* filename, long id, const char* data, long len, Durability d) {
+    char path[MAX_PATH_LEN];
+    segment_path(ss, filename, id, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return -1;
+    int ok = write_all(fd, data, len) == 0 && (d != DURABILITY_SYNC || fsync(fd) == 0);
+    if (close(fd) != 0) ok = 0;
+    if (!ok) unlink(path);
+    return ok ? 0 : -1;
+}
+
+// Length of the next segment of data[0, len): the rest if it is short,
+// otherwise about SS_SEGMENT_TARGET bytes, cut after a sentence delimiter and
+// the whitespace behind it so the next segment starts a sentence.
+static long segment_cut(const char* data, long len) {
+    if (len <= SS_SEGMENT_TARGET + SS_SEGMENT_TARGET / 2) return len;
+    long window = len - SS_SEGMENT_TARGET < SS_SEGMENT_TARGET ? len - SS_SEGMENT_TARGET : SS_SEGMENT_TARGET;
+    long cut = SS_SEGMENT_TARGET + text_find_delimiter(data + SS_SEGMENT_TARGET, window);
+    if (cut < len) {
+        cut++;
+        cut += text_skip_space(data + cut, len - cut);
+    }
+    return len - cut < SS_SEGMENT_TARGET / 2 ? len : cut;
+}
+
+// Newest version of the file, current or (if deleted) still pinned; caller
+// holds segment_mutex. Its next_id keeps new segment ids clear of old ones.
+static SegmentIndex* segfile_newest(SegmentFile* file) {
+    if (!file) return NULL;
+    if (file->current) return file->current;
+    SegmentIndex* idx = file->oldest;
+    while (idx && idx->newer) idx = idx->newer;
+    return idx;
+}
+
+// Installs 'idx', whose segments from 'first_id' on were just written, as the
+// current version. 'base' is the version it was made from (a reference the
+// caller took, released here) or NULL for a new or converted file.
+static int segments_commit(StorageServer* ss, const char* filename, SegmentIndex* base, SegmentIndex* idx,
+                           long first_id, Durability d) {
+    char path[MAX_PATH_LEN];
+    if (segidx_install(ss, filename, idx, d) != 0) {
+        for (long id = first_id; id < idx->next_id; id++) {
+            segment_path(ss, filename, id, path, sizeof(path));
+            unlink(path);
+        }
+        index_free(idx);
+        if (base) {
+            pthread_mutex_lock(&ss->segment_mutex);
+            base->refs--;
+            pthread_mutex_unlock(&ss->segment_mutex);
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    if (!file) file = segfile_add(ss, filename);
+    SegmentIndex* newest = segfile_newest(file);
+    if (newest) newest->newer = idx;
+    else file->oldest = idx;
+    int converted = !file->current;
+    file->current = idx;
+    if (d == DURABILITY_ASYNC) segfile_mark_dirty(file, first_id, idx->next_id);
+    if (base) base->refs--;
+    segfile_prune(ss, file);
+    pthread_mutex_unlock(&ss->segment_mutex);
+
+    if (converted) {
+        // The index now takes precedence; the plain copy is dead weight
+        snprintf(path, sizeof(path), "%s/%s", ss->storage_path, filename);
+        unlink(path);
+    }
+    return 0;
+}
+
+int ss_segments_write(StorageServer* ss, const char* filename, const char* data, long len, Durability d) {
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    SegmentIndex* old = file ? file->current : NULL;
+    SegmentIndex* newest = segfile_newest(file);
+    long first_id = newest ? newest->next_id : 1;
+    if (old) old->refs++;
+    pthread_mutex_unlock(&ss->segment_mutex);
+
+    // Segments whose bytes are unchanged at the front and at the back are kept
+    int count = old ? old->count : 0;
+    int head = 0, tail = count;
+    long pos = 0, end = len;
+    while (head < count && old->segs[head].len <= end - pos &&
+           old->segs[head].checksum == fnv1a64(FNV1A64_INIT, data + pos, old->segs[head].len)) {
+        pos += old->segs[head++].len;
+    }
+    while (tail > head && old->segs[tail - 1].len <= end - pos &&
+           old->segs[tail - 1].checksum == fnv1a64(FNV1A64_INIT, data + end - old->segs[tail - 1].len, old->segs[tail - 1].len)) {
+        end -= old->segs[--tail].len;
+    }
+    // A small neighbour is rewritten with the change, so edits don't leave slivers
+    if (pos < end || head < tail) {
+        if (head > 0 && old->segs[head - 1].len < SS_SEGMENT_TARGET / 4) pos -= old->segs[--head].len;
+        if (tail < count && old->segs[tail].len < SS_SEGMENT_TARGET / 4) end += old->segs[tail++].len;
+    }
+
+    SegmentIndex* idx = index_new(head + (count - tail) + (end - pos) / SS_SEGMENT_TARGET + 1);
+    if (head > 0) memcpy(idx->segs, old->segs, head * sizeof(SegmentEntry));
+    idx->count = head;
+    idx->next_id = first_id;
+    for (long p = pos; p < end; ) {
+        long n = segment_cut(data + p, end - p);
+        SegmentEntry* seg = &idx->segs[idx->count];
+        seg->id = idx->next_id;
+        seg->len = n;
+        seg->checksum = fnv1a64(FNV1A64_INIT, data + p, n);
+        if (segment_write(ss, filename, seg->id, data + p, n, d) != 0) {
+            idx->next_id++; // Not written, but clear the rest
+            for (long id = first_id; id < idx->next_id; id++) {
+                char path[MAX_PATH_LEN];
+                segment_path(ss, filename, id, path, sizeof(path));
+                unlink(path);
+            }
+            index_free(idx);
+            if (old) {
+                pthread_mutex_lock(&ss->segment_mutex);
+                old->refs--;
+                pthread_mutex_unlock(&ss->segment_mutex);
+            }
+            return -1;
+        }
+        idx->count++;
+        idx->next_id++;
+        p += n;
+    }
+    if (tail < count) memcpy(&idx->segs[idx->count], &old->segs[tail], (count - tail) * sizeof(SegmentEntry));
+    idx->count += count - tail;
+    index_layout(idx);
+    return segments_commit(ss, filename, old, idx, first_id, d);
+}
+
+int ss_segments_append(StorageServer* ss, const char* filename, const char* data, long len, Durability d) {
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    SegmentIndex* cur = file ? file->current : NULL;
+    if (cur) cur->refs++;
+    pthread_mutex_unlock(&ss->segment_mutex);
+    if (!cur) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // A small last segment is rewritten with the new bytes instead of
+    // starting another one
+    const SegmentEntry* last = cur->count > 0 ? &cur->segs[cur->count - 1] : NULL;
+    int merge = last && last->len < SS_SEGMENT_TARGET / 2;
+    long keep = merge ? last->len : 0;
+    char* buffer = (char*)malloc(keep + len + 1);
+    int ok = 1;
+    if (merge) {
+        char path[MAX_PATH_LEN];
+        segment_path(ss, filename, last->id, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        long got = 0;
+        ssize_t n;
+        while (fd >= 0 && got < keep && (n = pread(fd, buffer + got, keep - got, got)) > 0) got += n;
+        if (fd >= 0) close(fd);
+        ok = (got == keep);
+    }
+    memcpy(buffer + keep, data, len);
+    if (ok) ok = segment_write(ss, filename, cur->next_id, buffer, keep + len, d) == 0;
+    free(buffer);
+    if (!ok) {
+        pthread_mutex_lock(&ss->segment_mutex);
+        cur->refs--;
+        pthread_mutex_unlock(&ss->segment_mutex);
+        return -1;
+    }
+
+    SegmentIndex* idx = index_new(cur->count + 1);
+    memcpy(idx->segs, cur->segs, cur->count * sizeof(SegmentEntry));
+    idx->count = cur->count - merge;
+    SegmentEntry* seg = &idx->segs[idx->count++];
+    seg->id = cur->next_id;
+    seg->len = keep + len;
+    seg->checksum = fnv1a64(merge ? last->checksum : FNV1A64_INIT, data, len);
+    idx->next_id = cur->next_id + 1;
+    index_layout(idx);
+    return segments_commit(ss, filename, cur, idx, cur->next_id, d);
+}
+
+int ss_segments_fsync(StorageServer* ss, const char* filename) {
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    if (!file || !file->current) {
+        pthread_mutex_unlock(&ss->segment_mutex);
+        return 1;
+    }
+    long* dirty = file->dirty;
+    int dirty_count = file->dirty_count;
+    file->dirty = NULL;
+    file->dirty_count = file->dirty_capacity = 0;
+    pthread_mutex_unlock(&ss->segment_mutex);
+
+    char path[MAX_PATH_LEN];
+    int rc = 0;
+    for (int i = 0; i < dirty_count; i++) {
+        // A segment already replaced by a later commit is gone
+        segment_path(ss, filename, dirty[i], path, sizeof(path));
+        if (sync_path(path) < 0 && errno != ENOENT) rc = -1;
+    }
+    free(dirty);
+    segidx_path(ss, filename, path, sizeof(path));
+    if (sync_path(path) < 0 && errno != ENOENT) rc = -1;
+    return rc;
+}
+
+int ss_segments_remove(StorageServer* ss, const char* filename) {
+    char path[MAX_PATH_LEN];
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    if (!file || !file->current) {
+        pthread_mutex_unlock(&ss->segment_mutex);
+        return 0;
+    }
+    segidx_path(ss, filename, path, sizeof(path));
+    unlink(path);
+    file->current = NULL;
+    segfile_prune(ss, file);
+    pthread_mutex_unlock(&ss->segment_mutex);
+    return 1;
+}
+
+int ss_is_segmented(StorageServer* ss, const char* filename) {
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    int segmented = file && file->current;
+    pthread_mutex_unlock(&ss->segment_mutex);
+    return segmented;
+}
+
+// Every segment 'idx' lists is on disk with its recorded length.
+static int segments_present(StorageServer* ss, const char* filename, const SegmentIndex* idx) {
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    for (int i = 0; i < idx->count; i++) {
+        segment_path(ss, filename, idx->segs[i].id, path, sizeof(path));
+        if (stat(path, &st) != 0 || st.st_size != idx->segs[i].len) return 0;
+    }
+    return 1;
+}
+
+// Parses ".<file>.seg.<id>" into 'filename' and '*id'.
+static int parse_segment_name(const char* name, char* filename, size_t size, long* id) {
+    const char* mark = NULL;
+    for (const char* p = strstr(name, ".seg."); p; p = strstr(p + 1, ".seg.")) mark = p;
+    if (name[0] != '.' || !mark || mark == name || !isdigit((unsigned char)mark[5])) return 0;
+    for (const char* p = mark + 5; *p; p++) {
+        if (!isdigit((unsigned char)*p)) return 0;
+    }
+    size_t len = mark - name - 1;
+    if (len == 0 || len >= size) return 0;
+    memcpy(filename, name + 1, len);
+    filename[len] = '\0';
+    *id = atol(mark + 5);
+    return 1;
+}
+
+void ss_segments_recover(StorageServer* ss) {
+    DIR* d = opendir(ss->storage_path);
+    if (!d) return;
+    char path[MAX_PATH_LEN], filename[MAX_FILENAME_LEN];
+    char log_buf[BUFFER_SIZE];
+    int files = 0, converted = 0, orphans = 0;
+    struct dirent* dir;
+
+    pthread_mutex_lock(&ss->segment_mutex);
+    while ((dir = readdir(d)) != NULL) {
+        const char* name = dir->d_name;
+        size_t len = strlen(name);
+        snprintf(path, sizeof(path), "%s/%s", ss->storage_path, name);
+        if (name[0] == '.' && len > 11 && strcmp(name + len - 11, ".segidx.tmp") == 0) {
+            unlink(path); // An index a crash kept from being installed
+            continue;
+        }
+        if (name[0] != '.' || len <= 8 || strcmp(name + len - 7, ".segidx") != 0 || len - 8 >= sizeof(filename)) {
+            continue;
+        }
+        memcpy(filename, name + 1, len - 8);
+        filename[len - 8] = '\0';
+        SegmentIndex* idx = segidx_read(path);
+        if (!idx || !segments_present(ss, filename, idx)) {
+            snprintf(log_buf, sizeof(log_buf), "Segment index of %s is damaged; ignoring it.", filename);
+            log_message("SS", log_buf);
+            index_free(idx);
+            continue;
+        }
+        SegmentFile* file = segfile_add(ss, filename);
+        file->oldest = file->current = idx;
+        files++;
+        // A conversion that crashed after installing the index
+        snprintf(path, sizeof(path), "%s/%s", ss->storage_path, filename);
+        if (unlink(path) == 0) converted++;
+    }
+
+    rewinddir(d);
+    while ((dir = readdir(d)) != NULL) {
+        long id;
+        if (!parse_segment_name(dir->d_name, filename, sizeof(filename), &id)) continue;
+        SegmentFile* file = segfile_find(ss, filename);
+        if (file) {
+            const SegmentIndex* idx = file->current;
+            int listed = 0;
+            for (int i = 0; i < idx->count && !listed; i++) listed = idx->segs[i].id == id;
+            if (listed) continue;
+        } else {
+            // Segments of a damaged index are left for inspection
+            segidx_path(ss, filename, path, sizeof(path));
+            if (access(path, F_OK) == 0) continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", ss->storage_path, dir->d_name);
+        if (unlink(path) == 0) orphans++;
+    }
+    pthread_mutex_unlock(&ss->segment_mutex);
+    closedir(d);
+
+    if (files > 0 || orphans > 0 || ss->segmented) {
+        snprintf(log_buf, sizeof(log_buf), "Segmented format %s: %d segmented file(s), %d conversion(s) finished, "
+                 "%d orphaned segment(s) removed", ss->segmented ? "on" : "off", files, converted, orphans);
+        log_message("SS", log_buf);
+    }
+}
+
+// --- Access to either format ---
+
+int ss_file_stat(StorageServer* ss, const char* filename, struct stat* st) {
+    char path[MAX_PATH_LEN];
+    pthread_mutex_lock(&ss->segment_mutex);
+    SegmentFile* file = segfile_find(ss, filename);
+    long size = file && file->current ? file->current->size : -1;
+    pthread_mutex_unlock(&ss->segment_mutex);
+    if (size < 0) {
+        snprintf(path, sizeof(path), "%s/%s", ss->storage_path, filename);
+        return stat(path, st);
+    }
+    segidx_path(ss, filename, path, sizeof(path));
+    if (stat(path, st) != 0) return -1;
+    st->st_size = size;
+    return 0;
+}
+
+int ss_view_open_current(StorageServer* ss, const char* filename, FileView* view, ino_t* ino) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ss->storage_path, filename);
+    memset(view, 0, sizeof(FileView));
+    view->ss = ss;
+    strncpy(view->filename, filename, MAX_FILENAME_LEN - 1);
+    view->version = -1;
+    view->fd = -1;
+    view->seg = -1;
+    // Twice, in case a conversion removes the plain file in between
+    for (int attempt = 0; attempt < 2; attempt++) {
+        pthread_mutex_lock(&ss->segment_mutex);
+        SegmentFile* file = segfile_find(ss, filename);
+        if (file && file->current) {
+            view->index = file->current;
+            view->index->refs++;
+            view->size = view->index->size;
+            *ino = view->index->ino;
+            pthread_mutex_unlock(&ss->segment_mutex);
+            return 0;
+        }
+        pthread_mutex_unlock(&ss->segment_mutex);
+
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            view->fd = fd;
+            view->size = st.st_size;
+            *ino = st.st_ino;
+            return 0;
+        }
+        if (fd >= 0) close(fd);
+    }
+    return -1;
+}
+
+// Finds the open file and position holding byte 'off' of the view and how
+// many bytes of the view follow it there. Returns -1 past the end.
+static int view_locate(FileView* view, long off, int* fd, off_t* pos, long* avail) {
+    if (off >= view->size) return -1;
+    if (!view->index) {
+        *fd = view->fd;
+        *pos = off;
+        *avail = view->size - off;
+        return 0;
+    }
+    int k = index_locate(view->index, off);
+    const SegmentEntry* seg = &view->index->segs[k];
+    if (view->seg != k) {
+        char path[MAX_PATH_LEN];
+        if (view->fd >= 0) close(view->fd);
+        segment_path(view->ss, view->filename, seg->id, path, sizeof(path));
+        view->fd = open(path, O_RDONLY);
+        view->seg = view->fd >= 0 ? k : -1;
+        if (view->fd < 0) return -1;
+    }
+    *fd = view->fd;
+    *pos = off - seg->start;
+    *avail = seg->len - *pos;
+    return 0;
+}
+
+long ss_view_read(FileView* view, char* buf, long len, long off) {
+    long total = 0;
+    int fd;
+    off_t pos;
+    long avail;
+    while (total < len && view_locate(view, off + total, &fd, &pos, &avail) == 0) {
+        long want = len - total < avail ? len - total : avail;
+        ssize_t n = pread(fd, buf + total, want, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    return total;
+}
+
+long ss_view_send(FileView* view, int sock, long off, long len) {
+    long sent = 0;
+    int fd;
+    off_t pos;
+    long avail;
+    while (sent < len && view_locate(view, off + sent, &fd, &pos, &avail) == 0) {
+        long want = len - sent < avail ? len - sent : avail;
+        ssize_t n = sendfile(sock, fd, &pos, want);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += n;
+    }
+    return sent;
+}
+
+void ss_view_close(FileView* view) {
+    if (view->fd >= 0) close(view->fd);
+    view->fd = -1;
+    if (view->index) {
+        StorageServer* ss = view->ss;
+        pthread_mutex_lock(&ss->segment_mutex);
+        view->index->refs--;
+        SegmentFile* file = segfile_find(ss, view->filename);
+        if (file) segfile_prune(ss, file);
+        pthread_mutex_unlock(&ss->segment_mutex);
+        view->index = NULL;
+    }
+}
+
+char* ss_file_load(StorageServer* ss, const char* filename, long* len) {
+    FileView view;
+    ino_t ino;
+    if (ss_view_open_current(ss, filename, &view, &ino) < 0) return NULL;
+    char* content = (char*)malloc(view.size + 1);
+    long got = content ? ss_view_read(&view, content, view.size, 0) : 0;
+    ss_view_close(&view);
+    if (content) content[got] = '\0';
+    if (len) *len = got;
+    return content;
+}
+
+long ss_file_read_at(StorageServer* ss, const char* filename, char* buf, long len, long off) {
+    FileView view;
+    ino_t ino;
+    if (ss_view_open_current(ss, filename, &view, &ino) < 0) return -1;
+    long got = ss_view_read(&view, buf, len, off);
+    ss_view_close(&view);
+    return got;
+}
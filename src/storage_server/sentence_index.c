@@ -0,0 +1,386 @@
+#include "sentence_index.h"
+#include "file_parser.h"
+#include "persistence.h"
+#include "content_cache.h"
+#include "text_scan.h"
+#include "segment_store.h"
+
+// Indexes are tagged with the manifest version of the content they describe
+// and live in a hash table on the StorageServer. A missing or stale one is
+// loaded from the file's .sidx sidecar, or built with one pass over the
+// content and written back. Commits patch the index in place: sentences
+// before the first changed byte are kept, sentences after the last changed
+// byte are shifted, and only the region in between is scanned again.
+
+typedef struct {
+    int magic;
+    int format;
+    long version;
+    long size;          // File size and mtime when the sidecar was written
+    long mtime_sec;
+    long mtime_nsec;
+    int count;
+    int complete;
+} SidxHeader;
+
+static unsigned int sentence_index_hash(const char* filename) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *filename++)) hash = ((hash << 5) + hash) + c;
+    return hash % SS_SENTENCE_INDEX_BUCKETS;
+}
+
+static void sidx_path(StorageServer* ss, const char* filename, char* out, int size) {
+    snprintf(out, size, "%s/.%s.sidx", ss->storage_path, filename);
+}
+
+static SentenceIndex* index_new(const char* filename, long version, int capacity) {
+    SentenceIndex* idx = (SentenceIndex*)calloc(1, sizeof(SentenceIndex));
+    idx->filename = strdup(filename);
+    idx->version = version;
+    idx->capacity = capacity > 16 ? capacity : 16;
+    idx->spans = (SentenceSpan*)malloc(idx->capacity * sizeof(SentenceSpan));
+    return idx;
+}
+
+static void index_free(SentenceIndex* idx) {
+    if (!idx) return;
+    free(idx->filename);
+    free(idx->spans);
+    free(idx);
+}
+
+static void index_push(SentenceIndex* idx, long start, long end, int words) {
+    if (idx->count == idx->capacity) {
+        idx->capacity *= 2;
+        idx->spans = (SentenceSpan*)realloc(idx->spans, idx->capacity * sizeof(SentenceSpan));
+    }
+    SentenceSpan* span = &idx->spans[idx->count++];
+    span->start = start;
+    span->length = (int)(end - start);
+    span->words = words;
+}
+
+static void index_finish(SentenceIndex* idx, const char* data) {
+    if (idx->count == 0) {
+        idx->complete = 1; // An empty file can take sentence 0
+        return;
+    }
+    const SentenceSpan* last = &idx->spans[idx->count - 1];
+    idx->complete = is_delimiter(data[last->start + last->length - 1]);
+}
+
+// Index of the span starting exactly at 'start', or -1.
+static int index_find_start(const SentenceIndex* idx, long start) {
+    int lo = 0, hi = idx->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (idx->spans[mid].start == start) return mid;
+        if (idx->spans[mid].start < start) lo = mid + 1; else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Appends the sentences of data[pos, len) to 'idx'; 'after_delim' says 'pos'
+// directly follows a delimiter. With 'old' given, stops at the first sentence
+// start at or past 'stable_from' that 'old' also has (at that offset minus
+// 'delta') and returns its index in 'old'; otherwise returns -1.
+static int index_scan(SentenceIndex* idx, const char* data, long len, long pos, int after_delim,
+                      const SentenceIndex* old, long stable_from, long delta) {
+    if (after_delim) pos += text_skip_space(data + pos, len - pos);
+    while (pos < len) {
+        if (after_delim && old && pos >= stable_from) {
+            // Same bytes from here to EOF, same starting state: same sentences
+            int k = index_find_start(old, pos - delta);
+            if (k >= 0) return k;
+        }
+        long end = pos + text_find_delimiter(data + pos, len - pos);
+        if (end == len) {
+            index_push(idx, pos, len, (int)text_count_words(data + pos, len - pos, NULL));
+            break;
+        }
+        index_push(idx, pos, end + 1, (int)text_count_words(data + pos, end - pos, NULL) + 1);
+        pos = end + 1;
+        pos += text_skip_space(data + pos, len - pos);
+        after_delim = 1;
+    }
+    return -1;
+}
+
+static SentenceIndex* index_build(const char* filename, const CachedContent* content) {
+    SentenceIndex* idx = index_new(filename, content->version, 64);
+    index_scan(idx, content->data, content->len, 0, 0, NULL, 0, 0);
+    index_finish(idx, content->data);
+    return idx;
+}
+
+static void sidecar_write(StorageServer* ss, const SentenceIndex* idx) {
+    char path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN + 8];
+    struct stat st;
+    if (ss_file_stat(ss, idx->filename, &st) < 0) return;
+    sidx_path(ss, idx->filename, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    SidxHeader header = { SS_SIDX_MAGIC, SS_SIDX_FORMAT, idx->version, st.st_size,
+                          st.st_mtim.tv_sec, st.st_mtim.tv_nsec, idx->count, idx->complete };
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) return;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(idx->spans, sizeof(SentenceSpan), idx->count, f) == (size_t)idx->count;
+    if (fclose(f) != 0 || !ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+// Loads the sidecar if it still describes the file at 'version'.
+static SentenceIndex* sidecar_load(StorageServer* ss, const char* filename, long version) {
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    sidx_path(ss, filename, path, sizeof(path));
+    if (ss_file_stat(ss, filename, &st) < 0) return NULL;
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    SidxHeader header;
+    SentenceIndex* idx = NULL;
+    if (fread(&header, sizeof(header), 1, f) == 1 && header.magic == SS_SIDX_MAGIC &&
+        header.format == SS_SIDX_FORMAT && header.version == version && header.size == st.st_size &&
+        header.mtime_sec == st.st_mtim.tv_sec && header.mtime_nsec == st.st_mtim.tv_nsec && header.count >= 0) {
+        idx = index_new(filename, version, header.count);
+        if (fread(idx->spans, sizeof(SentenceSpan), header.count, f) == (size_t)header.count) {
+            idx->count = header.count;
+            idx->complete = header.complete;
+        } else {
+            index_free(idx);
+            idx = NULL;
+        }
+    }
+    fclose(f);
+    return idx;
+}
+
+// Caller holds sentence_index_mutex.
+static SentenceIndex* index_find(StorageServer* ss, const char* filename) {
+    SentenceIndex* idx = ss->sentence_index[sentence_index_hash(filename)];
+    while (idx && strcmp(idx->filename, filename) != 0) idx = idx->next;
+    return idx;
+}
+
+// Caller holds sentence_index_mutex. Replaces any entry for the same file.
+static void index_install(StorageServer* ss, SentenceIndex* idx) {
+    SentenceIndex** link = &ss->sentence_index[sentence_index_hash(idx->filename)];
+    while (*link) {
+        if (strcmp((*link)->filename, idx->filename) == 0) {
+            SentenceIndex* old = *link;
+            *link = old->next;
+            index_free(old);
+            break;
+        }
+        link = &(*link)->next;
+    }
+    idx->next = ss->sentence_index[sentence_index_hash(idx->filename)];
+    ss->sentence_index[sentence_index_hash(idx->filename)] = idx;
+}
+
+// Returns the index at 'version' (or a newer one, if a commit got there
+// first) with sentence_index_mutex held (the caller unlocks), or NULL with
+// it released if the file can't be read.
+static SentenceIndex* index_acquire_version(StorageServer* ss, const char* filename, long version) {
+    if (version < 0) return NULL;
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex* idx = index_find(ss, filename);
+    if (idx && idx->version == version) return idx;
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+
+    // Load or build outside the lock; other files stay usable meanwhile
+    idx = sidecar_load(ss, filename, version);
+    if (!idx) {
+        CachedContent* content = content_cache_get(ss, filename);
+        if (!content) return NULL;
+        idx = index_build(filename, content);
+        content_cache_release(content);
+        if (idx->version == version) sidecar_write(ss, idx);
+    }
+
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex* current = index_find(ss, filename);
+    if (current && current->version >= idx->version) {
+        index_free(idx); // A commit got there first
+        return current;
+    }
+    index_install(ss, idx);
+    return idx;
+}
+
+// Current index, as index_acquire_version().
+static SentenceIndex* index_acquire(StorageServer* ss, const char* filename) {
+    return index_acquire_version(ss, filename, ss_manifest_version(ss, filename));
+}
+
+int ss_sentence_range(StorageServer* ss, const char* filename, FileView* view,
+                      int first, int last, long* offset, long* length) {
+    SentenceIndex* idx = index_acquire_version(ss, filename, view->version);
+    SentenceIndex* built = NULL;
+    if (!idx || idx->version != view->version) {
+        if (idx) pthread_mutex_unlock(&ss->sentence_index_mutex);
+        // A commit replaced the file after 'view' was opened
+        CachedContent* content = content_cache_read_view(view);
+        if (!content) return ERROR_FILE_NOT_FOUND;
+        idx = built = index_build(filename, content);
+        content_cache_release(content);
+    }
+    int status = ERROR_INVALID_COMMAND;
+    if (first >= 0 && first <= last && last < idx->count) {
+        *offset = idx->spans[first].start;
+        *length = idx->spans[last].start + idx->spans[last].length - idx->spans[first].start;
+        status = 0;
+    }
+    if (built) index_free(built);
+    else pthread_mutex_unlock(&ss->sentence_index_mutex);
+    return status;
+}
+
+int ss_sentence_count(StorageServer* ss, const char* filename, int* complete) {
+    SentenceIndex* idx = index_acquire(ss, filename);
+    if (!idx) return -1;
+    int count = idx->count;
+    if (complete) *complete = idx->complete;
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+    return count;
+}
+
+int ss_sentence_spans(StorageServer* ss, const char* filename, const CachedContent* content, SentenceSpan** spans) {
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex* idx = index_find(ss, filename);
+    SentenceIndex* built = NULL;
+    if (!idx || idx->version != content->version) {
+        idx = built = index_build(filename, content);
+    }
+    int count = idx->count;
+    *spans = (SentenceSpan*)malloc((count + 1) * sizeof(SentenceSpan));
+    memcpy(*spans, idx->spans, count * sizeof(SentenceSpan));
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+    index_free(built);
+    return count;
+}
+
+int ss_sentence_index_commit(StorageServer* ss, const char* filename, const CachedContent* before,
+                             const char* after, long after_len, long version) {
+    // Bytes shared by both versions at the front and at the back
+    long common = before->len < after_len ? before->len : after_len;
+    long prefix = common_prefix(before->data, after, common);
+    long suffix = common_suffix(before->data + before->len, after + after_len, common - prefix);
+
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex* old = index_find(ss, filename);
+    SentenceIndex* built = NULL;
+    if (!old || old->version != before->version) {
+        old = built = index_build(filename, before);
+    }
+
+    // Keep every sentence that ends inside the common prefix
+    int keep = 0, hi = old->count;
+    while (keep < hi) {
+        int mid = (keep + hi) / 2;
+        if (old->spans[mid].start + old->spans[mid].length <= prefix) keep = mid + 1; else hi = mid;
+    }
+    SentenceIndex* idx = index_new(filename, version, old->count + 16);
+    memcpy(idx->spans, old->spans, keep * sizeof(SentenceSpan));
+    idx->count = keep;
+
+    long resume = keep > 0 ? idx->spans[keep - 1].start + idx->spans[keep - 1].length : 0;
+    int after_delim = keep > 0;
+    if (keep == old->count && keep > 0 && !old->complete) {
+        // An unfinished last sentence is scanned again together with the new bytes
+        resume = idx->spans[--idx->count].start;
+        after_delim = 0;
+    }
+    long delta = after_len - before->len;
+    int tail = index_scan(idx, after, after_len, resume, after_delim, old, after_len - suffix, delta);
+    for (int i = tail; i >= 0 && i < old->count; i++) {
+        SentenceSpan span = old->spans[i];
+        span.start += delta;
+        index_push(idx, span.start, span.start + span.length, span.words);
+    }
+    index_finish(idx, after);
+
+    int count = idx->count;
+    index_free(built);
+    index_install(ss, idx);
+    sidecar_write(ss, idx);
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+    return count;
+}
+
+int ss_sentence_index_append(StorageServer* ss, const char* filename, long before_version, long before_len,
+                             const char* added, long added_len, long version) {
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex* idx = index_find(ss, filename);
+    if (!idx || idx->version != before_version || (idx->count == 0 && before_len > 0)) {
+        pthread_mutex_unlock(&ss->sentence_index_mutex);
+        return -1; // Rebuilt on next use
+    }
+
+    // An unfinished last sentence is scanned again together with the new bytes
+    long region_start = before_len;
+    int after_delim = idx->count > 0;
+    if (idx->count > 0 && !idx->complete) {
+        region_start = idx->spans[--idx->count].start;
+        after_delim = 0;
+    }
+    long reopened = before_len - region_start;
+    char* region = (char*)malloc(reopened + added_len + 1);
+    int ok = 1;
+    if (reopened > 0) {
+        ok = ss_file_read_at(ss, filename, region, reopened, region_start) == reopened;
+    }
+    if (!ok) {
+        // Drop it; the next use rebuilds from the file
+        idx->count++;
+        idx->version = -1;
+        pthread_mutex_unlock(&ss->sentence_index_mutex);
+        free(region);
+        return -1;
+    }
+    memcpy(region + reopened, added, added_len);
+    long region_len = reopened + added_len;
+    region[region_len] = '\0';
+
+    SentenceIndex* tail = index_new(filename, version, 16);
+    index_scan(tail, region, region_len, 0, after_delim, NULL, 0, 0);
+    for (int i = 0; i < tail->count; i++) {
+        const SentenceSpan* span = &tail->spans[i];
+        index_push(idx, region_start + span->start, region_start + span->start + span->length, span->words);
+    }
+    if (tail->count > 0) {
+        const SentenceSpan* last = &tail->spans[tail->count - 1];
+        idx->complete = is_delimiter(region[last->start + last->length - 1]);
+    } else if (idx->count == 0) {
+        idx->complete = 1;
+    }
+    idx->version = version;
+    int count = idx->count;
+    index_free(tail);
+    free(region);
+    sidecar_write(ss, idx);
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+    return count;
+}
+
+void ss_sentence_index_remove(StorageServer* ss, const char* filename) {
+    char path[MAX_PATH_LEN];
+    pthread_mutex_lock(&ss->sentence_index_mutex);
+    SentenceIndex** link = &ss->sentence_index[sentence_index_hash(filename)];
+    while (*link) {
+        if (strcmp((*link)->filename, filename) == 0) {
+            SentenceIndex* idx = *link;
+            *link = idx->next;
+            index_free(idx);
+            break;
+        }
+        link = &(*link)->next;
+    }
+    pthread_mutex_unlock(&ss->sentence_index_mutex);
+    sidx_path(ss, filename, path, sizeof(path));
+    unlink(path);
+}
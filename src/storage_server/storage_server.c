@@ -1,129 +1,15 @@
 #include "storage_server.h"
 #include "persistence.h"
-
-// --- NEW: SHIFT LOGIC ---
-
-void log_modification(StorageServer* ss, const char* filename, int index, int delta) {
-    if (delta == 0) return;
-
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    
-    ModificationLogNode* new_node = (ModificationLogNode*)malloc(sizeof(ModificationLogNode));
-    new_node->id = ss->next_log_id++; // Assign ID
-    strncpy(new_node->filename, filename, MAX_FILENAME_LEN - 1);
-    new_node->original_sentence_index = index;
-    new_node->sentence_delta = delta;
-    new_node->next = NULL;
-    
-    if (!ss->mod_log_head) {
-        ss->mod_log_head = new_node;
-    } else {
-        ModificationLogNode* curr = ss->mod_log_head;
-        while (curr->next) {
-            curr = curr->next;
-        }
-        curr->next = new_node;
-    }
-    
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-}
-
-// Returns the ID of the *next* log to be created.
-// Any log with ID >= this value is "new" to the user.
-int get_current_log_id(StorageServer* ss) {
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    int id = ss->next_log_id;
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-    return id;
-}
-
-// Calculate shift only using logs that happened AFTER the user started editing.
-int get_sentence_shift(StorageServer* ss, const char* filename, int original_index, int start_log_id) {
-    int shift = 0;
-    
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    ModificationLogNode* curr = ss->mod_log_head;
-    
-    while (curr) {
-        // Only consider logs that are NEW (ID >= start_log_id)
-        if (curr->id >= start_log_id) {
-            if (strcmp(curr->filename, filename) == 0) {
-                if (curr->original_sentence_index < original_index) {
-                    shift += curr->sentence_delta;
-                }
-            }
-        }
-        curr = curr->next;
-    }
-    
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-    return shift;
-}
-
-
-// --- LOCKING LOGIC (Unchanged) ---
-
-pthread_mutex_t* get_file_commit_lock(StorageServer* ss, const char* filename) {
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    FileLockNode* curr = ss->file_locks_head;
-    while(curr) {
-        if (strcmp(curr->filename, filename) == 0) {
-            pthread_mutex_unlock(&ss->internal_locks_mutex);
-            return &curr->lock;
-        }
-        curr = curr->next;
-    }
-    FileLockNode* new_node = (FileLockNode*)malloc(sizeof(FileLockNode));
-    strncpy(new_node->filename, filename, MAX_FILENAME_LEN - 1);
-    pthread_mutex_init(&new_node->lock, NULL);
-    new_node->next = ss->file_locks_head;
-    ss->file_locks_head = new_node;
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-    return &new_node->lock;
-}
-
-int try_lock_sentence(StorageServer* ss, const char* filename, int sent_num) {
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    SentenceLockNode* curr = ss->sentence_locks_head;
-    while(curr) {
-        if (strcmp(curr->filename, filename) == 0 && curr->sentence_num == sent_num) {
-            pthread_mutex_unlock(&ss->internal_locks_mutex);
-            return 0; 
-        }
-        curr = curr->next;
-    }
-    SentenceLockNode* new_node = (SentenceLockNode*)malloc(sizeof(SentenceLockNode));
-    strncpy(new_node->filename, filename, MAX_FILENAME_LEN - 1);
-    new_node->sentence_num = sent_num;
-    new_node->next = ss->sentence_locks_head;
-    ss->sentence_locks_head = new_node;
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-    return 1;
-}
-
-void unlock_sentence(StorageServer* ss, const char* filename, int sent_num) {
-    pthread_mutex_lock(&ss->internal_locks_mutex);
-    SentenceLockNode* curr = ss->sentence_locks_head;
-    SentenceLockNode* prev = NULL;
-    while(curr) {
-        if (strcmp(curr->filename, filename) == 0 && curr->sentence_num == sent_num) {
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                ss->sentence_locks_head = curr->next;
-            }
-            free(curr);
-            break;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-    pthread_mutex_unlock(&ss->internal_locks_mutex);
-}
+#include "sentence_index.h"
+#include "content_cache.h"
+#include "durability.h"
+#include "undo_handler.h"
+#include "segment_store.h"
+#include <signal.h>
 
 // --- SERVER SETUP ---
 
-StorageServer* ss_create(const char* path, int client_port) {
+StorageServer* ss_create(const char* path, int client_port, long cache_bytes) {
     StorageServer* ss = (StorageServer*)calloc(1, sizeof(StorageServer));
     if (!ss) {
         perror("malloc StorageServer");
@@ -132,12 +18,23 @@ StorageServer* ss_create(const char* path, int client_port) {
     strncpy(ss->storage_path, path, MAX_PATH_LEN - 1);
     ss->client_port = client_port;
     ss->nm_sock = -1;
-    ss->file_locks_head = NULL;
-    ss->sentence_locks_head = NULL;
-    ss->mod_log_head = NULL;
-    ss->next_log_id = 0; // Initialize ID counter
-    pthread_mutex_init(&ss->internal_locks_mutex, NULL);
+    ss_locks_init(ss);
+    pthread_mutex_init(&ss->nm_send_mutex, NULL);
+    pthread_mutex_init(&ss->manifest_mutex, NULL);
+    pthread_mutex_init(&ss->stream_mutex, NULL);
+    pthread_mutex_init(&ss->sentence_index_mutex, NULL);
+    pthread_mutex_init(&ss->flush_mutex, NULL);
+    pthread_cond_init(&ss->flush_cond, NULL);
+    pthread_mutex_init(&ss->segment_mutex, NULL);
     mkdir(ss->storage_path, 0777);
+    const char* format = getenv(SS_FORMAT_ENV);
+    ss->segmented = format && strcmp(format, "segmented") == 0;
+    ss_segments_recover(ss);
+    ss->manifest_capacity = 1024;
+    ss->manifest_buckets = (ManifestEntry**)calloc(ss->manifest_capacity, sizeof(ManifestEntry*));
+    ss_manifest_load(ss);
+    const char* max_entry_mb = getenv(CONTENT_CACHE_MAX_ENTRY_ENV);
+    ss->content_cache = content_cache_create(cache_bytes, max_entry_mb ? atol(max_entry_mb) * 1024 * 1024 : 0);
     ss->client_listen_sock = create_listener_socket(client_port);
     if (ss->client_listen_sock < 0) {
         log_message("SS", "Failed to create client listener socket.");
@@ -163,13 +60,20 @@ void ss_connect_to_nm(StorageServer* ss, const char* nm_ip, int nm_port) {
         ss->nm_sock = -1;
         return;
     }
-    char* file_list = ss_scan_directory(ss->storage_path);
     char init_msg[BUFFER_SIZE];
-    snprintf(init_msg, sizeof(init_msg), "INIT_SS %d %s", ss->client_port, file_list);
-    send_message(ss->nm_sock, init_msg);
-    free(file_list);
+    snprintf(init_msg, sizeof(init_msg), "INIT_SS %d", ss->client_port);
+    int file_count = -1;
+    if (send_line(ss->nm_sock, init_msg) == 0) {
+        file_count = ss_send_manifest(ss, ss->nm_sock);
+    }
+    if (file_count < 0) {
+        perror("register with nm");
+        close(ss->nm_sock);
+        ss->nm_sock = -1;
+        return;
+    }
     char log_buf[100];
-    snprintf(log_buf, sizeof(log_buf), "Connected to NM at %s:%d", nm_ip, nm_port);
+    snprintf(log_buf, sizeof(log_buf), "Connected to NM at %s:%d (%d file(s) registered)", nm_ip, nm_port, file_count);
     log_message("SS", log_buf);
 }
 
@@ -179,6 +83,14 @@ void ss_run(StorageServer* ss, const char* nm_ip, int nm_port) {
         log_message("SS", "Failed to connect to NM. Exiting.");
         return;
     }
+    if (ss_streamer_start(ss) < 0) {
+        log_message("SS", "Failed to start streamer thread. Exiting.");
+        return;
+    }
+    if (ss_flusher_start(ss) < 0) {
+        log_message("SS", "Failed to start flusher thread. Exiting.");
+        return;
+    }
     pthread_t nm_listener_tid;
     SS_ThreadArgs* nm_args = (SS_ThreadArgs*)malloc(sizeof(SS_ThreadArgs));
     nm_args->ss = ss;
@@ -216,18 +128,123 @@ void* ss_listen_for_clients(void* arg) {
     return NULL;
 }
 
+// All writers to the NM socket go through here (commit threads, sync
+// threads and the NM listener all report back on the same connection).
+int ss_send_to_nm(StorageServer* ss, const char* message) {
+    pthread_mutex_lock(&ss->nm_send_mutex);
+    int result = ss->nm_sock >= 0 ? send_line(ss->nm_sock, message) : -1;
+    pthread_mutex_unlock(&ss->nm_send_mutex);
+    return result;
+}
+
+// Answers NM request 'req_id' with "ACK #<id> <status> <detail>".
+// Untagged commands (req_id < 0) are not acknowledged.
+static void ss_ack_nm(StorageServer* ss, long req_id, int status, const char* detail) {
+    if (req_id < 0) return;
+    char ack[BUFFER_SIZE];
+    snprintf(ack, sizeof(ack), "ACK #%ld %d %s", req_id, status, detail);
+    ss_send_to_nm(ss, ack);
+}
+
+// Fetches the primary's copy of a file over its client port and installs it
+// locally, then reports the version it now holds.
+void* ss_sync_from_primary(void* arg) {
+    SS_SyncArgs* args = (SS_SyncArgs*)arg;
+    StorageServer* ss = args->ss;
+    char log_buf[BUFFER_SIZE];
+    int ok = 0;
+
+    char filepath[MAX_PATH_LEN];
+    char tmp_filepath[MAX_PATH_LEN];
+    snprintf(filepath, sizeof(filepath), "%s/%s", ss->storage_path, args->filename);
+    snprintf(tmp_filepath, sizeof(tmp_filepath), "%s/%s.sync", ss->storage_path, args->filename);
+
+    int src_sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in src_addr;
+    memset(&src_addr, 0, sizeof(src_addr));
+    src_addr.sin_family = AF_INET;
+    src_addr.sin_port = htons(args->src_port);
+    inet_pton(AF_INET, args->src_ip, &src_addr.sin_addr);
+
+    if (src_sock >= 0 && connect(src_sock, (struct sockaddr*)&src_addr, sizeof(src_addr)) == 0) {
+        char req[BUFFER_SIZE];
+        char token[CAP_TOKEN_LEN];
+        cap_issue(CAP_SYSTEM_USER, args->filename, 'R', CAP_TOKEN_TTL_SEC, token, sizeof(token));
+        snprintf(req, sizeof(req), "GET_CONTENT %s %s", args->filename, token);
+        send_message(src_sock, req);
+
+        FILE* f = fopen(tmp_filepath, "w");
+        if (f) {
+            char buffer[BUFFER_SIZE];
+            int bytes;
+            long total = 0;
+            struct timeval start, now;
+            gettimeofday(&start, NULL);
+            while ((bytes = recv(src_sock, buffer, sizeof(buffer), 0)) > 0) {
+                fwrite(buffer, 1, bytes, f);
+                total += bytes;
+                if (args->rate_bps > 0) {
+                    // Throttle: sleep until we are back under rate_bps
+                    gettimeofday(&now, NULL);
+                    long elapsed_us = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec);
+                    long budget_us = (long)((double)total * 1000000.0 / args->rate_bps);
+                    if (budget_us > elapsed_us) usleep(budget_us - elapsed_us);
+                }
+            }
+            ok = (bytes == 0);
+            fclose(f);
+            FileLock* file_lock = ss_commit_lock(ss, args->filename);
+            if (ok && ss_install_file(ss, tmp_filepath, args->filename, SS_DEFAULT_DURABILITY) != 0) {
+                ok = 0;
+            }
+            if (ok) {
+                // The replica's own undo history no longer leads back from its content
+                ss_history_remove(ss, args->filename);
+                content_cache_invalidate(ss, args->filename);
+                ss_manifest_refresh(ss, args->filename, NULL);
+            }
+            ss_commit_unlock(ss, file_lock);
+            if (!ok) unlink(tmp_filepath);
+        }
+    }
+    if (src_sock >= 0) close(src_sock);
+
+    snprintf(log_buf, sizeof(log_buf), "Sync of '%s' v%ld from %s:%d %s", args->filename, args->version,
+             args->src_ip, args->src_port, ok ? "complete" : "FAILED");
+    log_message("SS", log_buf);
+
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%ld", args->version);
+    ss_ack_nm(ss, args->req_id, ok ? MSG_SUCCESS : ERROR_SYSTEM_FAILURE, ok ? detail : "Sync failed");
+
+    free(args);
+    return NULL;
+}
+
 void* ss_listen_to_nm(void* arg) {
     StorageServer* ss = ((SS_ThreadArgs*)arg)->ss;
     free(arg);
+    LineReader reader;
+    line_reader_init(&reader, ss->nm_sock);
     char buffer[BUFFER_SIZE];
-    while(recv_message(ss->nm_sock, buffer) > 0) {
+    while(recv_line(&reader, buffer, sizeof(buffer)) > 0) {
         char log_buf[BUFFER_SIZE + 20];
         snprintf(log_buf, sizeof(log_buf), "Received command from NM: %s", buffer);
         log_message("SS", log_buf);
         int count = 0;
-        char** parts = split_string(buffer, " ", &count);
+        char** all_parts = split_string(buffer, " ", &count);
+        char** parts = all_parts;
+        int total = count;
+        long req_id = -1;
+        if (count > 0 && parts[0][0] == '#') {
+            // "#<id> CMD args..." - a tracked request the NM waits on
+            req_id = atol(parts[0] + 1);
+            parts++;
+            count--;
+        }
         if (count < 2) {
-            free_split_string(parts, count);
+            ss_ack_nm(ss, req_id, ERROR_INVALID_COMMAND, "Malformed command");
+            free_split_string(all_parts, total);
             continue;
         }
         char* cmd = parts[0];
@@ -235,39 +252,92 @@ void* ss_listen_to_nm(void* arg) {
         char filepath[MAX_PATH_LEN];
         snprintf(filepath, sizeof(filepath), "%s/%s", ss->storage_path, filename);
         if (strcmp(cmd, "CREATE") == 0) {
-            FILE* f = fopen(filepath, "w");
-            if (f) {
-                fclose(f);
-                send_message(ss->nm_sock, "ACK_CREATE OK");
+            FILE* f = ss->segmented ? NULL : fopen(filepath, "w");
+            if (f) fclose(f);
+            if (f || (ss->segmented && ss_segments_write(ss, filename, "", 0, DURABILITY_NONE) == 0)) {
+                ss_manifest_put(ss, filename, "", 0, 0, NULL);
+                ss_ack_nm(ss, req_id, MSG_SUCCESS, "OK");
             } else {
-                send_message(ss->nm_sock, "ACK_CREATE FAIL");
+                ss_ack_nm(ss, req_id, ERROR_SYSTEM_FAILURE, strerror(errno));
             }
         } else if (strcmp(cmd, "DELETE") == 0) {
-            char undo_path[MAX_PATH_LEN];
-            snprintf(undo_path, sizeof(undo_path), "%s.undo", filepath);
-            unlink(filepath);
-            unlink(undo_path);
-            send_message(ss->nm_sock, "ACK_DELETE OK");
+            ss_history_remove(ss, filename);
+            ss_manifest_remove(ss, filename);
+            ss_sentence_index_remove(ss, filename);
+            content_cache_invalidate(ss, filename);
+            int segmented = ss_segments_remove(ss, filename);
+            int removed = unlink(filepath) == 0 || (segmented && errno == ENOENT);
+            int err = errno;
+            // A migrated-away copy is deleted while fenced; with the file gone
+            // late commits still fail, and a new copy here starts unfenced
+            set_file_fenced(ss, filename, 0);
+            if (removed) {
+                ss_ack_nm(ss, req_id, MSG_SUCCESS, "OK");
+            } else if (err == ENOENT) {
+                ss_ack_nm(ss, req_id, ERROR_FILE_NOT_FOUND, "File not found");
+            } else {
+                ss_ack_nm(ss, req_id, ERROR_SYSTEM_FAILURE, strerror(err));
+            }
+        } else if (strcmp(cmd, "SYNC") == 0 && (count == 5 || count == 6)) {
+            // SYNC <file> <primary_ip> <primary_port> <version> [rate_bps]
+            SS_SyncArgs* sync_args = (SS_SyncArgs*)malloc(sizeof(SS_SyncArgs));
+            sync_args->ss = ss;
+            strncpy(sync_args->filename, filename, MAX_FILENAME_LEN - 1);
+            sync_args->filename[MAX_FILENAME_LEN - 1] = '\0';
+            strncpy(sync_args->src_ip, parts[2], MAX_IP_LEN - 1);
+            sync_args->src_ip[MAX_IP_LEN - 1] = '\0';
+            sync_args->src_port = atoi(parts[3]);
+            sync_args->version = atol(parts[4]);
+            sync_args->rate_bps = (count == 6) ? atol(parts[5]) : 0;
+            sync_args->req_id = req_id;
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, ss_sync_from_primary, sync_args) != 0) {
+                free(sync_args);
+                ss_ack_nm(ss, req_id, ERROR_SYSTEM_FAILURE, "Could not start sync");
+            } else {
+                pthread_detach(tid);
+            }
+        } else if (strcmp(cmd, "FENCE") == 0) {
+            // Wait out any in-flight commit, then refuse new ones
+            FileLock* file_lock = ss_commit_lock(ss, filename);
+            set_file_fenced(ss, filename, 1);
+            ss_commit_unlock(ss, file_lock);
+            ss_ack_nm(ss, req_id, MSG_SUCCESS, "OK");
+        } else if (strcmp(cmd, "UNFENCE") == 0) {
+            set_file_fenced(ss, filename, 0);
+            ss_ack_nm(ss, req_id, MSG_SUCCESS, "OK");
         } else if (strcmp(cmd, "GET_CONTENT") == 0) {
-            handle_ss_read(ss, ss->nm_sock, filename);
+            handle_ss_read(ss, ss->nm_sock, filename, NULL);
+        } else {
+            ss_ack_nm(ss, req_id, ERROR_INVALID_COMMAND, "Unknown command");
         }
+        parts = all_parts;
+        count = total;
         free_split_string(parts, count);
     }
     log_message("SS", "Connection to NM lost. Exiting NM listener thread.");
+    pthread_mutex_lock(&ss->nm_send_mutex);
     ss->nm_sock = -1;
+    pthread_mutex_unlock(&ss->nm_send_mutex);
     return NULL;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: ./bin/storage_server <storage_path> <nm_ip> <nm_port> <client_port>\n");
+    if (argc != 5 && argc != 6) {
+        fprintf(stderr, "Usage: ./bin/storage_server <storage_path> <nm_ip> <nm_port> <client_port> [cache_mb]\n");
         return 1;
     }
     const char* path = argv[1];
     const char* nm_ip = argv[2];
     int nm_port = atoi(argv[3]);
     int client_port = atoi(argv[4]);
-    StorageServer* ss = ss_create(path, client_port);
+    long cache_mb = (argc == 6) ? atol(argv[5]) : CONTENT_CACHE_DEFAULT_MB; // 0 disables the cache
+    if (cap_init_key("SS") < 0) {
+        fprintf(stderr, "%s is not set (or set %s=1 for development)\n", CAP_KEY_ENV, CAP_DEV_KEY_ENV);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // READ uses sendfile(2), which has no MSG_NOSIGNAL
+    StorageServer* ss = ss_create(path, client_port, cache_mb * 1024 * 1024);
     if (!ss) {
         fprintf(stderr, "Failed to create Storage Server\n");
         return 1;
@@ -0,0 +1,191 @@
+#include "storage_server.h"
+#include "file_parser.h"
+#include "content_cache.h"
+#include "text_scan.h"
+#include <poll.h>
+#include <limits.h>
+
+// STREAM delivery. One thread drives every open stream from a poll() loop:
+// each job is paced by its own words/sec budget, words that are due are
+// batched into a single frame, and a frame the socket can't take yet is
+// parked until POLLOUT instead of blocking the thread.
+
+#define STREAM_FRAMES_PER_TICK 16 // Caps how long one unthrottled job holds the loop
+
+static long long stream_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// A "word" is a run of text plus the separators that follow it.
+static long stream_word_end(const StreamJob* job, long pos) {
+    const char* data = job->content->data;
+    pos += text_find_separator(data + pos, job->len - pos);
+    pos += text_skip_separators(data + pos, job->len - pos);
+    return pos;
+}
+
+// Packs up to 'owed' whole words into the job's frame.
+static void stream_fill_frame(StreamJob* job, long owed) {
+    int space = sizeof(job->frame);
+    job->frame_len = 0;
+    job->frame_off = 0;
+    while (owed > 0 && job->pos < job->len) {
+        long end = stream_word_end(job, job->pos);
+        long n = end - job->pos;
+        if (n > space - job->frame_len) {
+            if (job->frame_len > 0) break;
+            n = space; // A single word larger than a frame goes out in pieces
+        } else {
+            owed--;
+            job->words_sent++;
+        }
+        memcpy(job->frame + job->frame_len, job->content->data + job->pos, n);
+        job->frame_len += n;
+        job->pos += n;
+    }
+}
+
+// Sends whatever is due. Returns 0 once the job is finished or the client is
+// gone, 1 while it still has work.
+static int stream_pump(StreamJob* job, long long now) {
+    for (int frames = 0; frames < STREAM_FRAMES_PER_TICK; ) {
+        if (job->frame_off == job->frame_len) {
+            if (job->pos >= job->len) return 0;
+            long owed = LONG_MAX;
+            if (job->wps > 0) {
+                owed = (long)((now - job->start_ms) * job->wps / 1000) + 1 - job->words_sent;
+            }
+            if (owed <= 0) return 1;
+            stream_fill_frame(job, owed);
+            frames++;
+        }
+        ssize_t n = send(job->sock, job->frame + job->frame_off, job->frame_len - job->frame_off,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        job->frame_off += n;
+        if (job->frame_off < job->frame_len) return 1; // Socket full; wait for POLLOUT
+    }
+    return 1;
+}
+
+// Milliseconds until the job's next word is due.
+static int stream_next_due(const StreamJob* job, long long now) {
+    if (job->wps <= 0) return 0;
+    long long due = job->start_ms + (job->words_sent * 1000LL + job->wps - 1) / job->wps;
+    return due > now ? (int)(due - now) : 0;
+}
+
+static void stream_finish(StreamJob* job) {
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "STREAM finished: %ld word(s), %ld/%ld bytes sent",
+             job->words_sent, job->pos - (job->frame_len - job->frame_off), job->len);
+    log_message("SS", log_buf);
+    close(job->sock);
+    content_cache_release(job->content);
+    free(job);
+}
+
+static void* ss_streamer_thread(void* arg) {
+    StorageServer* ss = (StorageServer*)arg;
+    StreamJob* jobs = NULL;
+    struct pollfd* fds = NULL;
+    int fds_capacity = 0;
+
+    while (1) {
+        pthread_mutex_lock(&ss->stream_mutex);
+        while (ss->stream_incoming) {
+            StreamJob* job = ss->stream_incoming;
+            ss->stream_incoming = job->next;
+            job->next = jobs;
+            jobs = job;
+        }
+        pthread_mutex_unlock(&ss->stream_mutex);
+
+        int job_count = 0;
+        for (StreamJob* job = jobs; job; job = job->next) job_count++;
+        if (job_count + 1 > fds_capacity) {
+            fds_capacity = (job_count + 1) * 2;
+            fds = (struct pollfd*)realloc(fds, fds_capacity * sizeof(struct pollfd));
+        }
+
+        long long now = stream_now_ms();
+        int timeout = -1;
+        int nfds = 1;
+        fds[0].fd = ss->stream_wake[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        StreamJob** link = &jobs;
+        while (*link) {
+            StreamJob* job = *link;
+            if (!stream_pump(job, now)) {
+                *link = job->next;
+                stream_finish(job);
+                continue;
+            }
+            if (job->frame_off < job->frame_len) {
+                fds[nfds].fd = job->sock;
+                fds[nfds].events = POLLOUT;
+                fds[nfds].revents = 0;
+                nfds++;
+            } else {
+                int wait = stream_next_due(job, now);
+                if (timeout < 0 || wait < timeout) timeout = wait;
+            }
+            link = &job->next;
+        }
+
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR) {
+            perror("poll streamer");
+        }
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(ss->stream_wake[0], drain, sizeof(drain)) > 0);
+        }
+    }
+    return NULL;
+}
+
+int ss_streamer_start(StorageServer* ss) {
+    if (pipe(ss->stream_wake) < 0) {
+        perror("pipe streamer");
+        return -1;
+    }
+    fcntl(ss->stream_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(ss->stream_wake[1], F_SETFL, O_NONBLOCK);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ss_streamer_thread, ss) != 0) {
+        perror("pthread_create streamer");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+// Hands 'sock' and a reference to 'content' to the streamer thread, which
+// closes and releases them when the stream ends.
+int ss_stream_submit(StorageServer* ss, int sock, CachedContent* content, int wps) {
+    StreamJob* job = (StreamJob*)calloc(1, sizeof(StreamJob));
+    if (!job) return -1;
+    job->sock = sock;
+    job->content = content;
+    job->len = content->len;
+    job->wps = wps;
+    job->start_ms = stream_now_ms();
+
+    pthread_mutex_lock(&ss->stream_mutex);
+    job->next = ss->stream_incoming;
+    ss->stream_incoming = job;
+    pthread_mutex_unlock(&ss->stream_mutex);
+
+    char wake = 1;
+    if (write(ss->stream_wake[1], &wake, 1) < 0 && errno != EAGAIN) {
+        perror("wake streamer");
+    }
+    return 0;
+}
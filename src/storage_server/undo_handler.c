@@ -1,53 +1,253 @@
 #include "storage_server.h"
 #include "undo_handler.h"
 
-// Creates a backup of the current file for undo purposes.
-// Returns 1 on success, 0 on failure.
-int create_undo_backup(const char* filepath, const char* undo_filepath) {
-    // First, remove any old undo file
-    unlink(undo_filepath);
-
-    FILE* src = fopen(filepath, "r");
-    if (!src) {
-        // File doesn't exist (e.g., first WRITE), which is fine.
-        return 1;
-    }
-    
-    FILE* dest = fopen(undo_filepath, "w");
-    if (!dest) {
-        perror("fopen undo file");
-        fclose(src);
-        return 0;
-    }
-    
+// All history calls are made under the file's commit lock: UNDO and
+// compaction rewrite the log in place, so not even a reader can go without it.
+
+typedef struct {
+    HistRecord head;
+    long pos;             // Offset of the record in the log
+} HistEntry;
+
+static void hist_path(StorageServer* ss, const char* filename, char* out, int size) {
+    snprintf(out, size, "%s/.%s.hist", ss->storage_path, filename);
+}
+
+static int pread_all(int fd, char* buf, long len, long pos) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, pos);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const char* buf, long len, long pos) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads the header of every intact record, oldest first. Returns the count
+// (entries in a malloc'd *out) and sets *end just past the last intact one;
+// anything after it is a torn append.
+static int hist_scan(int fd, HistEntry** out, long* end) {
+    struct stat st;
+    HistEntry* entries = NULL;
+    int count = 0, capacity = 0;
+    long pos = 0;
+    HistRecord head;
+    if (fstat(fd, &st) == 0) {
+        while (pread_all(fd, (char*)&head, sizeof(head), pos) == 0 && head.magic == SS_HIST_MAGIC &&
+               head.user_len >= 0 && head.new_len >= 0 && head.old_len >= 0) {
+            long next = pos + sizeof(head) + head.user_len + head.old_len;
+            if (next > st.st_size) break;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                entries = (HistEntry*)realloc(entries, capacity * sizeof(HistEntry));
+            }
+            entries[count].head = head;
+            entries[count].pos = pos;
+            count++;
+            pos = next;
+        }
+    }
+    *out = entries;
+    *end = pos;
+    return count;
+}
+
+// Rewrites the log keeping only the bytes from 'keep_from' on.
+static void hist_compact(StorageServer* ss, const char* filename, int fd, long keep_from, long end) {
+    char path[MAX_PATH_LEN], tmp_path[MAX_PATH_LEN + 8];
+    hist_path(ss, filename, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) return;
     char buffer[BUFFER_SIZE];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, BUFFER_SIZE, src)) > 0) {
-        fwrite(buffer, 1, bytes, dest);
+    int ok = 1;
+    for (long pos = keep_from; ok && pos < end; ) {
+        long want = end - pos < (long)sizeof(buffer) ? end - pos : (long)sizeof(buffer);
+        ok = pread_all(fd, buffer, want, pos) == 0 && pwrite_all(out, buffer, want, pos - keep_from) == 0;
+        pos += want;
+    }
+    if (close(out) != 0 || !ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
     }
-    
-    fclose(src);
-    fclose(dest);
-    return 1;
 }
 
-// Reverts the file from the undo backup.
-// Returns 1 on success, 0 on failure.
-int perform_undo(const char* filepath, const char* undo_filepath) {
-    // Check if undo file exists
-    if (access(undo_filepath, F_OK) != 0) {
-        // No undo file exists
-        return 0;
+// Appends 'head' with 'user' and the replaced bytes 'old' (head->old_len).
+static void hist_append(StorageServer* ss, const char* filename, const char* user, const HistRecord* head,
+                        const char* old, int sync) {
+    char path[MAX_PATH_LEN];
+    hist_path(ss, filename, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+    HistEntry* entries;
+    long end;
+    int count = hist_scan(fd, &entries, &end);
+
+    long pos = end;
+    int ok = pwrite_all(fd, (const char*)head, sizeof(*head), pos) == 0 &&
+             pwrite_all(fd, user, head->user_len, pos + sizeof(*head)) == 0 &&
+             pwrite_all(fd, old, head->old_len, pos + sizeof(*head) + head->user_len) == 0;
+    end = pos + sizeof(*head) + head->user_len + head->old_len;
+    if (ok) {
+        if (ftruncate(fd, end) < 0) perror("ftruncate history");
+        if (sync) fsync(fd);
+        count++;
+    } else if (ftruncate(fd, pos) < 0) {
+        perror("ftruncate history");
     }
-    
-    // Rename undo file to main file
-    if (rename(undo_filepath, filepath) != 0) {
-        perror("rename undo");
-        return 0;
+
+    // Compact in bulk, not on every commit
+    if (count > 2 * SS_HISTORY_DEPTH) {
+        hist_compact(ss, filename, fd, entries[count - SS_HISTORY_DEPTH].pos, end);
     }
-    
-    return 1;
+    free(entries);
+    close(fd);
+}
+
+void ss_history_record(StorageServer* ss, const char* filename, const char* user,
+                       const char* before, long before_len, const char* after, long after_len,
+                       long version, int sync) {
+    long common = before_len < after_len ? before_len : after_len;
+    long prefix = common_prefix(before, after, common);
+    long suffix = common_suffix(before + before_len, after + after_len, common - prefix);
+    HistRecord head = { SS_HIST_MAGIC, (int)strlen(user), version, (long)time(NULL), after_len,
+                        prefix, after_len - prefix - suffix, before_len - prefix - suffix };
+    hist_append(ss, filename, user, &head, before + prefix, sync);
 }
 
-// NOTE: The function handle_ss_undo has been moved to file_ops.c
-// to better integrate with the global locking mechanism (ETIRW).
\ No newline at end of file
+void ss_history_record_append(StorageServer* ss, const char* filename, const char* user,
+                              long before_len, long added_len, long version, int sync) {
+    HistRecord head = { SS_HIST_MAGIC, (int)strlen(user), version, (long)time(NULL), before_len + added_len,
+                        before_len, added_len, 0 };
+    hist_append(ss, filename, user, &head, "", sync);
+}
+
+int ss_history_rewind(StorageServer* ss, const char* filename, const CachedContent* current, int steps,
+                      char** content, long* len, int* available) {
+    char path[MAX_PATH_LEN];
+    hist_path(ss, filename, path, sizeof(path));
+    *content = NULL;
+    *available = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return ERROR_FILE_NOT_FOUND;
+    HistEntry* entries;
+    long end;
+    int count = hist_scan(fd, &entries, &end);
+    *available = count;
+    if (steps > count) {
+        free(entries);
+        close(fd);
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    // The newest record must be the commit that produced 'current'
+    int status = (entries[count - 1].head.version == current->version) ? 0 : ERROR_SYSTEM_FAILURE;
+    long buf_len = current->len;
+    char* buf = (char*)malloc(buf_len + 1);
+    memcpy(buf, current->data, buf_len);
+    for (int i = count - 1; status == 0 && i >= count - steps; i--) {
+        HistRecord* h = &entries[i].head;
+        if (h->size_after != buf_len || h->offset + h->new_len > buf_len) {
+            status = ERROR_SYSTEM_FAILURE;
+            break;
+        }
+        long tail = buf_len - h->offset - h->new_len;
+        long new_buf_len = buf_len - h->new_len + h->old_len;
+        if (new_buf_len > buf_len) buf = (char*)realloc(buf, new_buf_len + 1);
+        memmove(buf + h->offset + h->old_len, buf + h->offset + h->new_len, tail);
+        if (pread_all(fd, buf + h->offset, h->old_len, entries[i].pos + sizeof(HistRecord) + h->user_len) < 0) {
+            status = ERROR_SYSTEM_FAILURE;
+        }
+        buf_len = new_buf_len;
+    }
+    free(entries);
+    close(fd);
+
+    if (status != 0) {
+        free(buf);
+        return status;
+    }
+    buf[buf_len] = '\0';
+    *content = buf;
+    *len = buf_len;
+    return 0;
+}
+
+void ss_history_pop(StorageServer* ss, const char* filename, int steps, long version) {
+    char path[MAX_PATH_LEN];
+    hist_path(ss, filename, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return;
+    HistEntry* entries;
+    long end;
+    int count = hist_scan(fd, &entries, &end);
+    int keep = count - steps;
+    if (keep >= 0 && keep < count) {
+        if (ftruncate(fd, entries[keep].pos) < 0) {
+            perror("ftruncate history");
+        }
+        // The record that is now newest describes the reinstated content
+        if (keep > 0) {
+            HistEntry* top = &entries[keep - 1];
+            top->head.version = version;
+            pwrite_all(fd, (const char*)&top->head, sizeof(HistRecord), top->pos);
+        }
+    }
+    free(entries);
+    close(fd);
+}
+
+char* ss_history_describe(StorageServer* ss, const char* filename, int* count) {
+    char path[MAX_PATH_LEN];
+    hist_path(ss, filename, path, sizeof(path));
+    *count = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return strdup("");
+    HistEntry* entries;
+    long end;
+    int n = hist_scan(fd, &entries, &end);
+
+    char* out = (char*)malloc(n * 160 + 1);
+    int used = 0;
+    out[0] = '\0';
+    for (int i = n - 1; i >= 0; i--) {
+        HistRecord* h = &entries[i].head;
+        char user[33] = "";
+        int user_len = h->user_len < 32 ? h->user_len : 32;
+        if (pread_all(fd, user, user_len, entries[i].pos + sizeof(HistRecord)) == 0) user[user_len] = '\0';
+        char when[32];
+        time_t t = (time_t)h->time;
+        struct tm tm;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+        int w = snprintf(out + used, 160, "%3d  v%-5ld %s  %-12s %8ld bytes  +%ld/-%ld\n",
+                         n - i, h->version, when, user, h->size_after, h->new_len, h->old_len);
+        used += w < 160 ? w : 159;
+    }
+    *count = n;
+    free(entries);
+    close(fd);
+    return out;
+}
+
+void ss_history_remove(StorageServer* ss, const char* filename) {
+    char path[MAX_PATH_LEN];
+    hist_path(ss, filename, path, sizeof(path));
+    unlink(path);
+}